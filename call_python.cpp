@@ -1,6 +1,9 @@
 #include <Python.h>
+#include <string>
 #include <vector>
 #include <iostream>
+#include "note_stream.h"
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
 #include "numpy/arrayobject.h"
 
 using namespace std;
@@ -8,13 +11,25 @@ using namespace std;
 int
 main(int argc, char *argv[])
 {
-	putenv("PYTHONPATH=.");
+	setenv("PYTHONPATH", ".", 1);
     PyObject *pName, *pModule, *pDict, *pFunc;
     PyObject *pArgs, *pValue;
     int i;
 
+    // -v prints the probability of every predicted note to stderr
+    bool verbose = (argc > 1 && std::string(argv[1]) == "-v");
+
     Py_Initialize();
+    if (_import_array() < 0) {
+        PyErr_Print();
+        fprintf(stderr, "Failed to import numpy\n");
+        return 1;
+    }
+#if PY_MAJOR_VERSION >= 3
+    pName = PyUnicode_FromString("rnn_LSTM_CPU");
+#else
     pName = PyString_FromString("rnn_LSTM_CPU");
+#endif
     /* Error checking of pName left out */
 
     pModule = PyImport_Import(pName);
@@ -30,17 +45,65 @@ main(int argc, char *argv[])
             pValue = PyObject_CallObject(pFunc, NULL);
             //Py_DECREF(pArgs);
             if (pValue != NULL) {
-                std::vector<int> data;
-                if(PyList_Check(pValue))
-                {
-                    for(Py_ssize_t i = 0; i < PyList_Size(pValue); i++)
-                    {
-                        PyObject *value = PyList_GetItem(pValue, i);
-                        data.push_back(PyFloat_AsDouble(value));
+                // predict_connection() returns (notes, probabilities) as
+                // ndarrays; view them through the numpy C API instead of
+                // boxing every element into a Python object
+                PyObject *pNotes = pValue, *pProbs = NULL;
+                if (PyTuple_Check(pValue) && PyTuple_Size(pValue) == 2) {
+                    pNotes = PyTuple_GetItem(pValue, 0);
+                    pProbs = PyTuple_GetItem(pValue, 1);
+                }
+
+                // no copy when the array is already contiguous and of this type
+                PyArrayObject *notes = (PyArrayObject *)PyArray_FROM_OTF(pNotes, NPY_INTP, NPY_ARRAY_IN_ARRAY);
+                PyArrayObject *probs = NULL;
+                if (pProbs != NULL)
+                    probs = (PyArrayObject *)PyArray_FROM_OTF(pProbs, NPY_DOUBLE, NPY_ARRAY_IN_ARRAY);
+
+                if (notes == NULL || (pProbs != NULL && probs == NULL)) {
+                    PyErr_Print();
+                    fprintf(stderr, "Unexpected result type\n");
+                    Py_XDECREF(notes);
+                    Py_DECREF(pValue);
+                    return 1;
+                }
+
+                npy_intp T = PyArray_SIZE(notes);
+                const npy_intp *data = (const npy_intp *)PyArray_DATA(notes);
+
+                // (T, 12) softmax output, one contiguous row per frame
+                const double *p = NULL;
+                npy_intp O = 0;
+                if (probs != NULL && PyArray_NDIM(probs) == 2 && PyArray_DIM(probs, 0) == T) {
+                    O = PyArray_DIM(probs, 1);
+                    p = (const double *)PyArray_DATA(probs);
+                }
+
+                // one record per frame: the note, its probability and its frame
+                std::vector<NoteRecord> records(T);
+                for (npy_intp j = 0; j < T; j++) {
+                    if (data[j] < 0 || (p && data[j] >= O)) {
+                        fprintf(stderr, "Note %ld of frame %ld is out of range\n",
+                                (long)data[j], (long)j);
+                        Py_XDECREF(probs);
+                        Py_DECREF(notes);
+                        Py_DECREF(pValue);
+                        return 1;
                     }
+                    records[j].note = (int32_t)data[j];
+                    records[j].confidence = p ? (float)p[j * O + data[j]] : 0.0f;
+                    records[j].onset = (uint32_t)j;
+                    records[j].duration = 1;
+                    if (verbose)
+                        fprintf(stderr, "frame %ld note %ld p=%.3f\n",
+                                (long)j, (long)data[j], records[j].confidence);
                 }
-                for(int j = 0; j < data.size(); j++)
-                    std::cout << data[j] << ' ';
+                uint16_t flags = NOTE_STREAM_TIMING | (p ? NOTE_STREAM_CONFIDENCE : 0);
+                note_stream_write(stdout, records, flags);
+                fflush(stdout);
+
+                Py_XDECREF(probs);
+                Py_DECREF(notes);
                 Py_DECREF(pValue);
             }
             else {
@@ -0,0 +1,145 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Radix-2 / Bluestein FFT, see fft.h.
+
+#include <cmath>
+#include <stdexcept>
+
+#include "fft.h"
+
+using namespace std;
+
+static size_t next_pow2(size_t n)
+{
+    size_t m = 1;
+    while (m < n)
+        m <<= 1;
+    return m;
+}
+
+ComplexFFT::ComplexFFT(size_t n) : n(n)
+{
+    if (n == 0)
+        throw runtime_error("fft: empty transform");
+
+    bool pow2 = (n & (n - 1)) == 0;
+    m = pow2 ? n : next_pow2(2 * n - 1);
+
+    twiddle.resize(m / 2);
+    for (size_t j = 0; j < m / 2; j++)
+        twiddle[j] = polar(1.0, -2.0 * M_PI * (double)j / (double)m);
+
+    if (pow2)
+        return;
+
+    // j^2 is reduced mod 2n first, the angle would lose all precision
+    // for the half a million point frames otherwise
+    chirp.resize(n);
+    for (size_t j = 0; j < n; j++)
+    {
+        unsigned long long q = ((unsigned long long)j * j) % (2 * (unsigned long long)n);
+        chirp[j] = polar(1.0, -M_PI * (double)q / (double)n);
+    }
+
+    kernel.assign(m, cplx(0.0, 0.0));
+    kernel[0] = conj(chirp[0]);
+    for (size_t j = 1; j < n; j++)
+        kernel[j] = kernel[m - j] = conj(chirp[j]);
+    radix2(&kernel[0], false);
+    work.resize(m);
+}
+
+void ComplexFFT::radix2(cplx *x, bool inverse)
+{
+    for (size_t i = 1, j = 0; i < m; i++)
+    {
+        size_t bit = m >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j)
+            swap(x[i], x[j]);
+    }
+
+    for (size_t len = 2; len <= m; len <<= 1)
+    {
+        size_t half = len / 2, step = m / len;
+        for (size_t i = 0; i < m; i += len)
+        {
+            for (size_t k = 0; k < half; k++)
+            {
+                cplx w = inverse ? conj(twiddle[k * step]) : twiddle[k * step];
+                cplx u = x[i + k];
+                cplx v = x[i + k + half] * w;
+                x[i + k] = u + v;
+                x[i + k + half] = u - v;
+            }
+        }
+    }
+}
+
+void ComplexFFT::transform(cplx *x)
+{
+    if (chirp.empty())
+    {
+        radix2(x, false);
+        return;
+    }
+
+    // Bluestein: the DFT as a convolution with the chirp, done on the
+    // power of two grid
+    for (size_t j = 0; j < n; j++)
+        work[j] = x[j] * chirp[j];
+    for (size_t j = n; j < m; j++)
+        work[j] = cplx(0.0, 0.0);
+
+    radix2(&work[0], false);
+    for (size_t j = 0; j < m; j++)
+        work[j] *= kernel[j];
+    radix2(&work[0], true);
+
+    double scale = 1.0 / (double)m;
+    for (size_t k = 0; k < n; k++)
+        x[k] = work[k] * chirp[k] * scale;
+}
+
+RealFFT::RealFFT(size_t n, size_t bins) :
+    n(n), nbins(bins < n / 2 + 1 ? bins : n / 2 + 1), half(n % 2 == 0 ? n / 2 : n)
+{
+    packed.resize(half.size());
+    if (n % 2 == 0)
+    {
+        rotate.resize(nbins);
+        for (size_t k = 0; k < nbins; k++)
+            rotate[k] = polar(1.0, -2.0 * M_PI * (double)k / (double)n);
+    }
+}
+
+void RealFFT::transform(const double *x, cplx *X)
+{
+    if (n % 2 != 0)
+    {
+        for (size_t j = 0; j < n; j++)
+            packed[j] = cplx(x[j], 0.0);
+        half.transform(&packed[0]);
+        for (size_t k = 0; k < nbins; k++)
+            X[k] = packed[k];
+        return;
+    }
+
+    // even/odd samples as one complex sequence of half the length, then
+    // split the spectra apart again
+    size_t h = n / 2;
+    for (size_t j = 0; j < h; j++)
+        packed[j] = cplx(x[2 * j], x[2 * j + 1]);
+    half.transform(&packed[0]);
+
+    for (size_t k = 0; k < nbins; k++)
+    {
+        cplx a = packed[k % h];
+        cplx b = conj(packed[(h - k % h) % h]);
+        cplx even = 0.5 * (a + b);
+        cplx odd = cplx(0.0, -0.5) * (a - b);
+        X[k] = even + rotate[k] * odd;
+    }
+}
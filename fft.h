@@ -0,0 +1,58 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Real-input FFT of arbitrary length, the transform behind the spectral
+// frames the LSTM reads (the python side used to import it from an
+// external fft module). Frames are sample_rate * 10 samples long for
+// 0.1 Hz bins, which is rarely a power of two, so lengths other than
+// 2^k go through Bluestein's chirp-z algorithm on a power of two grid.
+
+#ifndef FFT_H
+#define FFT_H
+
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+typedef std::complex<double> cplx;
+
+// in-place complex DFT of any length, X[k] = sum_j x[j] exp(-2 pi i jk/n)
+class ComplexFFT
+{
+public:
+    explicit ComplexFFT(size_t n);
+
+    size_t size() const { return n; }
+    void transform(cplx *x);
+
+protected:
+    size_t n;
+    size_t m;                       // power of two grid, n itself when n = 2^k
+    std::vector<cplx> twiddle;      // m/2 roots of unity for the radix-2 passes
+    std::vector<cplx> chirp;        // exp(-i pi j^2 / n), Bluestein only
+    std::vector<cplx> kernel;       // transformed conjugate chirp, Bluestein only
+    std::vector<cplx> work;
+
+    void radix2(cplx *x, bool inverse);
+};
+
+// first `bins` outputs of the DFT of n real samples, as numpy.fft.rfft
+class RealFFT
+{
+public:
+    RealFFT(size_t n, size_t bins);
+
+    size_t size() const { return n; }
+    size_t bins() const { return nbins; }
+
+    // x holds n samples, X receives bins() coefficients
+    void transform(const double *x, cplx *X);
+
+protected:
+    size_t n;
+    size_t nbins;
+    ComplexFFT half;                // n/2 points when n is even, else n
+    std::vector<cplx> packed;
+    std::vector<cplx> rotate;       // exp(-2 pi i k / n) for the even/odd split
+};
+
+#endif
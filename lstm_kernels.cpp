@@ -0,0 +1,980 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Hot loops of the LSTM forward pass, see lstm_kernels.h.
+//
+// The SIMD variants are compiled with per-function target attributes and
+// picked at run time, so the library still runs on machines without AVX.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <thread>
+
+#include "lstm_kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LSTM_X86 1
+// gcc 12 reports its own _mm512_undefined_ps() placeholders as uninitialized
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// set by lstm_set_isa() while inference threads may be reading it
+static atomic<int> forced_isa(-1);
+
+#ifdef LSTM_X86
+static int detect_isa()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return LSTM_ISA_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return LSTM_ISA_AVX2;
+    return LSTM_ISA_SCALAR;
+}
+#endif
+
+LSTMIsa lstm_isa()
+{
+    int forced = forced_isa.load();
+    if (forced >= 0)
+        return (LSTMIsa)forced;
+#ifdef LSTM_X86
+    // the first caller detects, concurrent ones wait for it
+    static const int detected = detect_isa();
+    return (LSTMIsa)detected;
+#else
+    return LSTM_ISA_SCALAR;
+#endif
+}
+
+void lstm_set_isa(LSTMIsa isa)
+{
+    forced_isa = isa;
+}
+
+const char *lstm_isa_name(LSTMIsa isa)
+{
+    switch (isa)
+    {
+        case LSTM_ISA_AVX512: return "avx512";
+        case LSTM_ISA_AVX2:   return "avx2";
+        default:              return "scalar";
+    }
+}
+
+void lstm_pack(const float *U, const float *W, const float *b, int hidden,
+               LSTMPacked &p)
+{
+    int H = hidden;
+    int nb = (H + LSTM_BLOCK - 1) / LSTM_BLOCK;
+    p.hidden = H;
+    p.padded = nb * LSTM_BLOCK;
+    AlignedFloats pw((size_t)nb * 2 * H * 4 * LSTM_BLOCK, 0.0f);
+    AlignedFloats pbias((size_t)nb * 4 * LSTM_BLOCK, 0.0f);
+
+    for (int kb = 0; kb < nb; kb++)
+    {
+        for (int l = 0; l < LSTM_BLOCK; l++)
+        {
+            int k = kb * LSTM_BLOCK + l;
+            if (k >= H)
+                break;
+            for (int g = 0; g < 4; g++)
+            {
+                const float *u = U + ((size_t)g * H + k) * H;
+                const float *w = W + ((size_t)g * H + k) * H;
+                for (int j = 0; j < H; j++)
+                {
+                    pw[(((size_t)kb * 2 * H + j) * 4 + g) * LSTM_BLOCK + l] = u[j];
+                    pw[(((size_t)kb * 2 * H + H + j) * 4 + g) * LSTM_BLOCK + l] = w[j];
+                }
+                // the g gate reuses b[2] exactly like forward_prop() does
+                pbias[((size_t)kb * 4 + g) * LSTM_BLOCK + l] = b[(size_t)(g == 3 ? 2 : g) * H + k];
+            }
+        }
+    }
+    p.w = SharedWeights<float>(std::move(pw));
+    p.bias = SharedWeights<float>(std::move(pbias));
+}
+
+// columns of A per cache block in lstm_project(): 16 KB of a row, so a
+// block of the rows owned by one thread stays in L2 across frames
+#define PROJECT_KC      4096
+// frames sharing one pass over a block of A
+#define PROJECT_NT      4
+
+static inline float hard_sigmoid(float x)
+{
+    x = x * 0.2f + 0.5f;
+    return x < 0.0f ? 0.0f : (x > 1.0f ? 1.0f : x);
+}
+
+// The step kernels are templates on the hidden size HC: HC = 0 is the
+// generic path that reads the shape from p, a known HC turns every trip
+// count into a constant, so the compiler unrolls the column loops without
+// remainder checks and drops the odd-column tail of the AVX-512 kernel.
+template <int HC>
+static void lstm_step_scalar(const LSTMPacked &p, const float *x_e, const float *s_prev,
+                             float *s, float *c)
+{
+    const int H = HC ? HC : p.hidden;
+    const int nb = HC ? (HC + LSTM_BLOCK - 1) / LSTM_BLOCK : p.padded / LSTM_BLOCK;
+    for (int kb = 0; kb < nb; kb++)
+    {
+        float acc[4][LSTM_BLOCK];
+        const float *bias = &p.bias[(size_t)kb * 4 * LSTM_BLOCK];
+        for (int g = 0; g < 4; g++)
+            for (int l = 0; l < LSTM_BLOCK; l++)
+                acc[g][l] = bias[g * LSTM_BLOCK + l];
+
+        const float *w = &p.w[(size_t)kb * 2 * H * 4 * LSTM_BLOCK];
+        for (int j = 0; j < 2 * H; j++, w += 4 * LSTM_BLOCK)
+        {
+            float v = (j < H) ? x_e[j] : s_prev[j - H];
+            for (int g = 0; g < 4; g++)
+                for (int l = 0; l < LSTM_BLOCK; l++)
+                    acc[g][l] += w[g * LSTM_BLOCK + l] * v;
+        }
+
+        for (int l = 0; l < LSTM_BLOCK; l++)
+        {
+            int k = kb * LSTM_BLOCK + l;
+            float i = hard_sigmoid(acc[0][l]);
+            float f = hard_sigmoid(acc[1][l]);
+            float o = hard_sigmoid(acc[2][l]);
+            float g = tanhf(acc[3][l]);
+            c[k] = c[k] * f + g * i;
+            s[k] = tanhf(c[k]) * o;
+        }
+    }
+}
+
+// y[f] = a.dot(x[f]) for the PROJECT_NT frames x[0..PROJECT_NT)
+static void dot4_scalar(const float *a, const float *const *x, int n, float *y)
+{
+    for (int f = 0; f < PROJECT_NT; f++)
+    {
+        float acc = 0.0f;
+        for (int k = 0; k < n; k++)
+            acc += a[k] * x[f][k];
+        y[f] = acc;
+    }
+}
+
+#ifdef LSTM_X86
+
+__attribute__((target("avx2,fma")))
+static void dot4_avx2(const float *a, const float *const *x, int n, float *y)
+{
+    __m256 acc[PROJECT_NT];
+    for (int f = 0; f < PROJECT_NT; f++)
+        acc[f] = _mm256_setzero_ps();
+
+    int k = 0;
+    for (; k + 8 <= n; k += 8)
+    {
+        __m256 va = _mm256_loadu_ps(a + k);
+        for (int f = 0; f < PROJECT_NT; f++)
+            acc[f] = _mm256_fmadd_ps(va, _mm256_loadu_ps(x[f] + k), acc[f]);
+    }
+
+    for (int f = 0; f < PROJECT_NT; f++)
+    {
+        __m128 h = _mm_add_ps(_mm256_castps256_ps128(acc[f]), _mm256_extractf128_ps(acc[f], 1));
+        h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+        h = _mm_add_ss(h, _mm_shuffle_ps(h, h, 1));
+        float sum = _mm_cvtss_f32(h);
+        for (int r = k; r < n; r++)
+            sum += a[r] * x[f][r];
+        y[f] = sum;
+    }
+}
+
+__attribute__((target("avx512f")))
+static void dot4_avx512(const float *a, const float *const *x, int n, float *y)
+{
+    __m512 acc[PROJECT_NT];
+    for (int f = 0; f < PROJECT_NT; f++)
+        acc[f] = _mm512_setzero_ps();
+
+    int k = 0;
+    for (; k + 16 <= n; k += 16)
+    {
+        __m512 va = _mm512_loadu_ps(a + k);
+        for (int f = 0; f < PROJECT_NT; f++)
+            acc[f] = _mm512_fmadd_ps(va, _mm512_loadu_ps(x[f] + k), acc[f]);
+    }
+    if (k < n)
+    {
+        __mmask16 m = (__mmask16)((1u << (n - k)) - 1);
+        __m512 va = _mm512_maskz_loadu_ps(m, a + k);
+        for (int f = 0; f < PROJECT_NT; f++)
+            acc[f] = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, x[f] + k), acc[f]);
+    }
+
+    for (int f = 0; f < PROJECT_NT; f++)
+        y[f] = _mm512_reduce_add_ps(acc[f]);
+}
+
+#endif
+
+typedef void (*Dot4)(const float *, const float *const *, int, float *);
+
+static Dot4 dot4_kernel()
+{
+#ifdef LSTM_X86
+    switch (lstm_isa())
+    {
+        case LSTM_ISA_AVX512: return dot4_avx512;
+        case LSTM_ISA_AVX2:   return dot4_avx2;
+        default: break;
+    }
+#endif
+    return dot4_scalar;
+}
+
+// rows [r0, r1) of X_e for every frame
+static void project_rows(Dot4 dot4, const float *A, const float *X, int T, int cols,
+                         float *X_e, int ld, int r0, int r1)
+{
+    for (int t = 0; t < T; t++)
+        fill(X_e + (size_t)t * ld + r0, X_e + (size_t)t * ld + r1, 0.0f);
+
+    for (int k0 = 0; k0 < cols; k0 += PROJECT_KC)
+    {
+        int n = min(PROJECT_KC, cols - k0);
+        for (int t0 = 0; t0 < T; t0 += PROJECT_NT)
+        {
+            // short tails repeat the last frame and drop its results
+            const float *x[PROJECT_NT];
+            for (int f = 0; f < PROJECT_NT; f++)
+                x[f] = X + (size_t)min(t0 + f, T - 1) * cols + k0;
+
+            for (int r = r0; r < r1; r++)
+            {
+                float y[PROJECT_NT];
+                dot4(A + (size_t)r * cols + k0, x, n, y);
+                for (int f = 0; f < PROJECT_NT && t0 + f < T; f++)
+                    X_e[(size_t)(t0 + f) * ld + r] += y[f];
+            }
+        }
+    }
+}
+
+void lstm_project(const float *A, const float *X, int T, int rows, int cols,
+                  float *X_e, int ld, int threads)
+{
+    Dot4 dot4 = dot4_kernel();
+    if (threads <= 0)
+        threads = max(1, (int)thread::hardware_concurrency());
+    threads = min(threads, rows);
+
+    if (threads <= 1 || T <= 0)
+    {
+        project_rows(dot4, A, X, T, cols, X_e, ld, 0, rows);
+        return;
+    }
+
+    // every thread owns a contiguous slab of rows, so the writes never
+    // overlap and each slab of A is read by exactly one core
+    vector<thread> pool;
+    for (int i = 0; i < threads; i++)
+    {
+        int r0 = (int)((long long)rows * i / threads);
+        int r1 = (int)((long long)rows * (i + 1) / threads);
+        pool.push_back(thread(project_rows, dot4, A, X, T, cols, X_e, ld, r0, r1));
+    }
+    for (size_t i = 0; i < pool.size(); i++)
+        pool[i].join();
+}
+
+void lstm_pack_columns(const float *A, int rows, int cols, LSTMColumns &c)
+{
+    c.rows = rows;
+    c.cols = cols;
+    c.ld = (rows + LSTM_BLOCK - 1) / LSTM_BLOCK * LSTM_BLOCK;
+    AlignedFloats w((size_t)cols * c.ld, 0.0f);
+    for (int r = 0; r < rows; r++)
+        for (int k = 0; k < cols; k++)
+            w[(size_t)k * c.ld + r] = A[(size_t)r * cols + k];
+    c.w = SharedWeights<float>(std::move(w));
+}
+
+int lstm_active_bins(const float *x, int cols, float threshold, int top_k, int *idx)
+{
+    int n = 0;
+    for (int k = 0; k < cols; k++)
+        if (fabsf(x[k]) >= threshold)
+            idx[n++] = k;
+
+    if (top_k > 0 && n > top_k)
+    {
+        struct Larger
+        {
+            const float *x;
+            bool operator()(int a, int b) const { return fabsf(x[a]) > fabsf(x[b]); }
+        } larger = { x };
+        nth_element(idx, idx + top_k, idx + n, larger);
+        n = top_k;
+        // keep the column walk sequential
+        sort(idx, idx + n);
+    }
+    return n;
+}
+
+static void axpy_columns_scalar(const LSTMColumns &c, const float *x, const int *idx, int n,
+                                float *x_e)
+{
+    for (int j = 0; j < n; j++)
+    {
+        const float *w = &c.w[(size_t)idx[j] * c.ld];
+        float v = x[idx[j]];
+        for (int r = 0; r < c.ld; r++)
+            x_e[r] += v * w[r];
+    }
+}
+
+#ifdef LSTM_X86
+
+__attribute__((target("avx2,fma")))
+static void axpy_columns_avx2(const LSTMColumns &c, const float *x, const int *idx, int n,
+                              float *x_e)
+{
+    for (int r0 = 0; r0 < c.ld; r0 += LSTM_BLOCK)
+    {
+        __m256 acc0 = _mm256_loadu_ps(x_e + r0);
+        __m256 acc1 = _mm256_loadu_ps(x_e + r0 + 8);
+        for (int j = 0; j < n; j++)
+        {
+            const float *w = &c.w[(size_t)idx[j] * c.ld + r0];
+            __m256 v = _mm256_set1_ps(x[idx[j]]);
+            acc0 = _mm256_fmadd_ps(_mm256_load_ps(w), v, acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_load_ps(w + 8), v, acc1);
+        }
+        _mm256_storeu_ps(x_e + r0, acc0);
+        _mm256_storeu_ps(x_e + r0 + 8, acc1);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void axpy_columns_avx512(const LSTMColumns &c, const float *x, const int *idx, int n,
+                                float *x_e)
+{
+    for (int r0 = 0; r0 < c.ld; r0 += LSTM_BLOCK)
+    {
+        __m512 acc = _mm512_loadu_ps(x_e + r0);
+        for (int j = 0; j < n; j++)
+            acc = _mm512_fmadd_ps(_mm512_load_ps(&c.w[(size_t)idx[j] * c.ld + r0]),
+                                  _mm512_set1_ps(x[idx[j]]), acc);
+        _mm512_storeu_ps(x_e + r0, acc);
+    }
+}
+
+#endif
+
+void lstm_project_sparse(const LSTMColumns &c, const float *x, const int *idx, int n,
+                         float *x_e)
+{
+    fill(x_e, x_e + c.ld, 0.0f);
+#ifdef LSTM_X86
+    switch (lstm_isa())
+    {
+        case LSTM_ISA_AVX512: axpy_columns_avx512(c, x, idx, n, x_e); return;
+        case LSTM_ISA_AVX2:   axpy_columns_avx2(c, x, idx, n, x_e); return;
+        default: break;
+    }
+#endif
+    axpy_columns_scalar(c, x, idx, n, x_e);
+}
+
+void lstm_quantize_rows(const float *A, int rows, int cols, LSTMInt8 &q)
+{
+    q.rows = rows;
+    q.cols = cols;
+    q.ld = (cols + LSTM_ALIGN - 1) / LSTM_ALIGN * LSTM_ALIGN;
+    AlignedInt8 w((size_t)rows * q.ld, 0);
+    AlignedFloats scales(rows, 0.0f);
+
+    for (int r = 0; r < rows; r++)
+    {
+        const float *a = A + (size_t)r * cols;
+        float m = 0.0f;
+        for (int k = 0; k < cols; k++)
+            m = max(m, fabsf(a[k]));
+        float scale = (m > 0.0f) ? m / 127.0f : 1.0f;
+        scales[r] = scale;
+        for (int k = 0; k < cols; k++)
+            w[(size_t)r * q.ld + k] = (signed char)lrintf(a[k] / scale);
+    }
+    q.w = SharedWeights<signed char>(std::move(w));
+    q.scale = SharedWeights<float>(std::move(scales));
+}
+
+// quantize one frame with a symmetric per-frame scale, returns the scale
+static float quantize_frame(const float *x, int cols, signed char *qx)
+{
+    float m = 0.0f;
+    for (int k = 0; k < cols; k++)
+        m = max(m, fabsf(x[k]));
+    float scale = (m > 0.0f) ? m / 127.0f : 1.0f;
+    for (int k = 0; k < cols; k++)
+        qx[k] = (signed char)lrintf(x[k] / scale);
+    return scale;
+}
+
+static int dot_i8_scalar(const signed char *a, const signed char *x, int n)
+{
+    int acc = 0;
+    for (int k = 0; k < n; k++)
+        acc += a[k] * x[k];
+    return acc;
+}
+
+#ifdef LSTM_X86
+
+// n is a multiple of LSTM_ALIGN for both SIMD variants
+__attribute__((target("avx2")))
+static int dot_i8_avx2(const signed char *a, const signed char *x, int n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    for (int k = 0; k < n; k += 16)
+    {
+        __m256i va = _mm256_cvtepi8_epi16(_mm_load_si128((const __m128i *)(a + k)));
+        __m256i vx = _mm256_cvtepi8_epi16(_mm_load_si128((const __m128i *)(x + k)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vx));
+    }
+    __m128i h = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    h = _mm_add_epi32(h, _mm_shuffle_epi32(h, 0x4e));
+    h = _mm_add_epi32(h, _mm_shuffle_epi32(h, 0xb1));
+    return _mm_cvtsi128_si32(h);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static int dot_i8_avx512(const signed char *a, const signed char *x, int n)
+{
+    __m512i acc = _mm512_setzero_si512();
+    for (int k = 0; k < n; k += 32)
+    {
+        __m512i va = _mm512_cvtepi8_epi16(_mm256_load_si256((const __m256i *)(a + k)));
+        __m512i vx = _mm512_cvtepi8_epi16(_mm256_load_si256((const __m256i *)(x + k)));
+        acc = _mm512_add_epi32(acc, _mm512_madd_epi16(va, vx));
+    }
+    return _mm512_reduce_add_epi32(acc);
+}
+
+#endif
+
+typedef int (*DotI8)(const signed char *, const signed char *, int);
+
+static DotI8 dot_i8_kernel()
+{
+#ifdef LSTM_X86
+    switch (lstm_isa())
+    {
+        case LSTM_ISA_AVX512:
+            if (__builtin_cpu_supports("avx512bw"))
+                return dot_i8_avx512;
+            return dot_i8_avx2;
+        case LSTM_ISA_AVX2:
+            return dot_i8_avx2;
+        default:
+            break;
+    }
+#endif
+    return dot_i8_scalar;
+}
+
+static void project_rows_int8(DotI8 dot, const LSTMInt8 &q, const signed char *qx,
+                              const float *sx, int T, float *X_e, int ld, int r0, int r1)
+{
+    for (int t = 0; t < T; t++)
+    {
+        const signed char *xt = qx + (size_t)t * q.ld;
+        for (int r = r0; r < r1; r++)
+            X_e[(size_t)t * ld + r] = q.scale[r] * sx[t] *
+                                      (float)dot(&q.w[(size_t)r * q.ld], xt, q.ld);
+    }
+}
+
+void lstm_project_int8(const LSTMInt8 &q, const float *X, int T,
+                       float *X_e, int ld, int threads)
+{
+    AlignedInt8 qx((size_t)T * q.ld, 0);
+    vector<float> sx(T);
+    for (int t = 0; t < T; t++)
+        sx[t] = quantize_frame(X + (size_t)t * q.cols, q.cols, &qx[(size_t)t * q.ld]);
+
+    DotI8 dot = dot_i8_kernel();
+    if (threads <= 0)
+        threads = max(1, (int)thread::hardware_concurrency());
+    threads = min(threads, q.rows);
+
+    if (threads <= 1 || T <= 0)
+    {
+        project_rows_int8(dot, q, &qx[0], &sx[0], T, X_e, ld, 0, q.rows);
+        return;
+    }
+
+    vector<thread> pool;
+    for (int i = 0; i < threads; i++)
+    {
+        int r0 = (int)((long long)q.rows * i / threads);
+        int r1 = (int)((long long)q.rows * (i + 1) / threads);
+        pool.push_back(thread(project_rows_int8, dot, cref(q), &qx[0], &sx[0], T, X_e, ld, r0, r1));
+    }
+    for (size_t i = 0; i < pool.size(); i++)
+        pool[i].join();
+}
+
+#ifdef LSTM_X86
+
+// Cephes style expf: 2^n * p(r) with |r| <= ln2/2
+__attribute__((target("avx2,fma")))
+static inline __m256 exp_avx2(__m256 x)
+{
+    x = _mm256_min_ps(x, _mm256_set1_ps(88.3762626647949f));
+    x = _mm256_max_ps(x, _mm256_set1_ps(-88.3762626647949f));
+
+    __m256 n = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(1.44269504088896341f),
+                                               _mm256_set1_ps(0.5f)));
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+
+    __m256 y = _mm256_set1_ps(1.9875691500E-4f);
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(1.3981999507E-3f));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(8.3334519073E-3f));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(4.1665795894E-2f));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(1.6666665459E-1f));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(5.0000001201E-1f));
+    y = _mm256_fmadd_ps(y, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+    __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(y, _mm256_castsi256_ps(e));
+}
+
+// tanh(x) = 1 - 2 / (exp(2x) + 1)
+__attribute__((target("avx2,fma")))
+static inline __m256 tanh_avx2(__m256 x)
+{
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 e = exp_avx2(_mm256_add_ps(x, x));
+    return _mm256_sub_ps(one, _mm256_div_ps(_mm256_set1_ps(2.0f), _mm256_add_ps(e, one)));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 hard_sigmoid_avx2(__m256 x)
+{
+    x = _mm256_fmadd_ps(x, _mm256_set1_ps(0.2f), _mm256_set1_ps(0.5f));
+    return _mm256_min_ps(_mm256_max_ps(x, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+}
+
+// acc += packed panel columns w[0..n) times v[0..n), returns the next panel;
+// n is the template argument unless that is 0
+template <int NC>
+__attribute__((target("avx2,fma")))
+static inline const float *accumulate_avx2(const float *w, const float *v, int n, __m256 *acc)
+{
+    if (NC)
+        n = NC;
+#pragma GCC unroll 4
+    for (int j = 0; j < n; j++, w += 4 * LSTM_BLOCK)
+    {
+        __m256 x = _mm256_set1_ps(v[j]);
+        for (int a = 0; a < 8; a++)
+            acc[a] = _mm256_fmadd_ps(_mm256_load_ps(w + a * 8), x, acc[a]);
+    }
+    return w;
+}
+
+template <int HC>
+__attribute__((target("avx2,fma")))
+static void lstm_step_avx2(const LSTMPacked &p, const float *x_e, const float *s_prev,
+                           float *s, float *c)
+{
+    const int H = HC ? HC : p.hidden;
+    const int nb = HC ? (HC + LSTM_BLOCK - 1) / LSTM_BLOCK : p.padded / LSTM_BLOCK;
+    for (int kb = 0; kb < nb; kb++)
+    {
+        // one block is two halves of 8 lanes: 8 independent accumulators
+        const float *bias = &p.bias[(size_t)kb * 4 * LSTM_BLOCK];
+        __m256 acc[8];
+        for (int a = 0; a < 8; a++)
+            acc[a] = _mm256_load_ps(bias + a * 8);
+
+        const float *w = &p.w[(size_t)kb * 2 * H * 4 * LSTM_BLOCK];
+        w = accumulate_avx2<HC>(w, x_e, H, acc);
+        accumulate_avx2<HC>(w, s_prev, H, acc);
+
+        for (int h = 0; h < 2; h++)
+        {
+            float *ck = c + kb * LSTM_BLOCK + h * 8;
+            float *sk = s + kb * LSTM_BLOCK + h * 8;
+            __m256 i = hard_sigmoid_avx2(acc[0 + h]);
+            __m256 f = hard_sigmoid_avx2(acc[2 + h]);
+            __m256 o = hard_sigmoid_avx2(acc[4 + h]);
+            __m256 g = tanh_avx2(acc[6 + h]);
+            __m256 cc = _mm256_fmadd_ps(_mm256_loadu_ps(ck), f, _mm256_mul_ps(g, i));
+            _mm256_storeu_ps(ck, cc);
+            _mm256_storeu_ps(sk, _mm256_mul_ps(tanh_avx2(cc), o));
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 exp_avx512(__m512 x)
+{
+    x = _mm512_min_ps(x, _mm512_set1_ps(88.3762626647949f));
+    x = _mm512_max_ps(x, _mm512_set1_ps(-88.3762626647949f));
+
+    __m512 n = _mm512_roundscale_ps(_mm512_fmadd_ps(x, _mm512_set1_ps(1.44269504088896341f),
+                                                    _mm512_set1_ps(0.5f)),
+                                    _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(0.693359375f), x);
+    r = _mm512_fnmadd_ps(n, _mm512_set1_ps(-2.12194440e-4f), r);
+
+    __m512 y = _mm512_set1_ps(1.9875691500E-4f);
+    y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(1.3981999507E-3f));
+    y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(8.3334519073E-3f));
+    y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(4.1665795894E-2f));
+    y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(1.6666665459E-1f));
+    y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(5.0000001201E-1f));
+    y = _mm512_fmadd_ps(y, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+
+    __m512i e = _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)), 23);
+    return _mm512_mul_ps(y, _mm512_castsi512_ps(e));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 tanh_avx512(__m512 x)
+{
+    __m512 one = _mm512_set1_ps(1.0f);
+    __m512 e = exp_avx512(_mm512_add_ps(x, x));
+    return _mm512_sub_ps(one, _mm512_div_ps(_mm512_set1_ps(2.0f), _mm512_add_ps(e, one)));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 hard_sigmoid_avx512(__m512 x)
+{
+    x = _mm512_fmadd_ps(x, _mm512_set1_ps(0.2f), _mm512_set1_ps(0.5f));
+    return _mm512_min_ps(_mm512_max_ps(x, _mm512_setzero_ps()), _mm512_set1_ps(1.0f));
+}
+
+// like accumulate_avx2(), even and odd columns go to acc and acc2
+template <int NC>
+__attribute__((target("avx512f")))
+static inline const float *accumulate_avx512(const float *w, const float *v, int n,
+                                             __m512 *acc, __m512 *acc2)
+{
+    if (NC)
+        n = NC;
+    int j = 0;
+#pragma GCC unroll 2
+    for (; j + 1 < n; j += 2, w += 8 * LSTM_BLOCK)
+    {
+        __m512 v0 = _mm512_set1_ps(v[j]);
+        __m512 v1 = _mm512_set1_ps(v[j + 1]);
+        for (int g = 0; g < 4; g++)
+        {
+            acc[g] = _mm512_fmadd_ps(_mm512_load_ps(w + g * LSTM_BLOCK), v0, acc[g]);
+            acc2[g] = _mm512_fmadd_ps(_mm512_load_ps(w + (4 + g) * LSTM_BLOCK), v1, acc2[g]);
+        }
+    }
+    if ((NC == 0 || NC % 2) && j < n)
+    {
+        __m512 v0 = _mm512_set1_ps(v[j]);
+        for (int g = 0; g < 4; g++)
+            acc[g] = _mm512_fmadd_ps(_mm512_load_ps(w + g * LSTM_BLOCK), v0, acc[g]);
+        w += 4 * LSTM_BLOCK;
+    }
+    return w;
+}
+
+template <int HC>
+__attribute__((target("avx512f")))
+static void lstm_step_avx512(const LSTMPacked &p, const float *x_e, const float *s_prev,
+                             float *s, float *c)
+{
+    const int H = HC ? HC : p.hidden;
+    const int nb = HC ? (HC + LSTM_BLOCK - 1) / LSTM_BLOCK : p.padded / LSTM_BLOCK;
+    for (int kb = 0; kb < nb; kb++)
+    {
+        // two sets of gate accumulators over even/odd inputs to hide
+        // the FMA latency
+        const float *bias = &p.bias[(size_t)kb * 4 * LSTM_BLOCK];
+        __m512 acc[4], acc2[4];
+        for (int g = 0; g < 4; g++)
+        {
+            acc[g] = _mm512_load_ps(bias + g * LSTM_BLOCK);
+            acc2[g] = _mm512_setzero_ps();
+        }
+
+        const float *w = &p.w[(size_t)kb * 2 * H * 4 * LSTM_BLOCK];
+        w = accumulate_avx512<HC>(w, x_e, H, acc, acc2);
+        accumulate_avx512<HC>(w, s_prev, H, acc, acc2);
+
+        float *ck = c + kb * LSTM_BLOCK;
+        float *sk = s + kb * LSTM_BLOCK;
+        __m512 i = hard_sigmoid_avx512(_mm512_add_ps(acc[0], acc2[0]));
+        __m512 f = hard_sigmoid_avx512(_mm512_add_ps(acc[1], acc2[1]));
+        __m512 o = hard_sigmoid_avx512(_mm512_add_ps(acc[2], acc2[2]));
+        __m512 g = tanh_avx512(_mm512_add_ps(acc[3], acc2[3]));
+        __m512 cc = _mm512_fmadd_ps(_mm512_loadu_ps(ck), f, _mm512_mul_ps(g, i));
+        _mm512_storeu_ps(ck, cc);
+        _mm512_storeu_ps(sk, _mm512_mul_ps(tanh_avx512(cc), o));
+    }
+}
+
+#endif
+
+template <int HC>
+static void lstm_step_shaped(const LSTMPacked &p, const float *x_e, const float *s_prev,
+                             float *s, float *c)
+{
+#ifdef LSTM_X86
+    switch (lstm_isa())
+    {
+        case LSTM_ISA_AVX512: lstm_step_avx512<HC>(p, x_e, s_prev, s, c); return;
+        case LSTM_ISA_AVX2:   lstm_step_avx2<HC>(p, x_e, s_prev, s, c); return;
+        default: break;
+    }
+#endif
+    lstm_step_scalar<HC>(p, x_e, s_prev, s, c);
+}
+
+bool lstm_step_specialized(int hidden)
+{
+    return hidden == LSTM_HIDDEN_OCTAVE || hidden == LSTM_HIDDEN_KEYBOARD;
+}
+
+void lstm_step(const LSTMPacked &p, const float *x_e, const float *s_prev,
+               float *s, float *c)
+{
+    switch (p.hidden)
+    {
+        case LSTM_HIDDEN_OCTAVE:   lstm_step_shaped<LSTM_HIDDEN_OCTAVE>(p, x_e, s_prev, s, c); return;
+        case LSTM_HIDDEN_KEYBOARD: lstm_step_shaped<LSTM_HIDDEN_KEYBOARD>(p, x_e, s_prev, s, c); return;
+        default:                   lstm_step_shaped<0>(p, x_e, s_prev, s, c); return;
+    }
+}
+
+// Batched steps: a tile of NB sequences shares every load of a weight
+// panel, so the recurrent products become (4*hidden, 2*hidden) x
+// (2*hidden, NB) GEMMs instead of NB separate GEMVs. The tile is as wide
+// as the accumulators of all its sequences fit in the registers.
+#define LSTM_TILE_SCALAR    4
+#define LSTM_TILE_AVX2      3   // per half block: 3 x 4 gates = 12 ymm
+#define LSTM_TILE_AVX512    4   // 4 x 4 gates = 16 zmm
+
+template <int HC, int NB>
+static void lstm_tile_scalar(const LSTMPacked &p, const float *const *x_e,
+                             const float *const *s_prev, float *const *s, float *const *c)
+{
+    const int H = HC ? HC : p.hidden;
+    const int nb = HC ? (HC + LSTM_BLOCK - 1) / LSTM_BLOCK : p.padded / LSTM_BLOCK;
+    for (int kb = 0; kb < nb; kb++)
+    {
+        float acc[NB][4 * LSTM_BLOCK];
+        const float *bias = &p.bias[(size_t)kb * 4 * LSTM_BLOCK];
+        for (int b = 0; b < NB; b++)
+            for (int l = 0; l < 4 * LSTM_BLOCK; l++)
+                acc[b][l] = bias[l];
+
+        const float *w = &p.w[(size_t)kb * 2 * H * 4 * LSTM_BLOCK];
+        for (int j = 0; j < 2 * H; j++, w += 4 * LSTM_BLOCK)
+            for (int b = 0; b < NB; b++)
+            {
+                float v = (j < H) ? x_e[b][j] : s_prev[b][j - H];
+                for (int l = 0; l < 4 * LSTM_BLOCK; l++)
+                    acc[b][l] += w[l] * v;
+            }
+
+        for (int b = 0; b < NB; b++)
+            for (int l = 0; l < LSTM_BLOCK; l++)
+            {
+                int k = kb * LSTM_BLOCK + l;
+                float i = hard_sigmoid(acc[b][l]);
+                float f = hard_sigmoid(acc[b][LSTM_BLOCK + l]);
+                float o = hard_sigmoid(acc[b][2 * LSTM_BLOCK + l]);
+                float g = tanhf(acc[b][3 * LSTM_BLOCK + l]);
+                c[b][k] = c[b][k] * f + g * i;
+                s[b][k] = tanhf(c[b][k]) * o;
+            }
+    }
+}
+
+#ifdef LSTM_X86
+
+template <int NC, int NB>
+__attribute__((target("avx2,fma")))
+static inline const float *accumulate_tile_avx2(const float *w, const float *const *v, int n,
+                                                __m256 (*acc)[4])
+{
+    if (NC)
+        n = NC;
+#pragma GCC unroll 2
+    for (int j = 0; j < n; j++, w += 4 * LSTM_BLOCK)
+    {
+        __m256 x[NB];
+#pragma GCC unroll 4
+        for (int b = 0; b < NB; b++)
+            x[b] = _mm256_set1_ps(v[b][j]);
+#pragma GCC unroll 4
+        for (int g = 0; g < 4; g++)
+        {
+            __m256 wg = _mm256_load_ps(w + g * LSTM_BLOCK);
+#pragma GCC unroll 4
+            for (int b = 0; b < NB; b++)
+                acc[b][g] = _mm256_fmadd_ps(wg, x[b], acc[b][g]);
+        }
+    }
+    return w;
+}
+
+template <int HC, int NB>
+__attribute__((target("avx2,fma")))
+static void lstm_tile_avx2(const LSTMPacked &p, const float *const *x_e,
+                           const float *const *s_prev, float *const *s, float *const *c)
+{
+    const int H = HC ? HC : p.hidden;
+    const int nb = HC ? (HC + LSTM_BLOCK - 1) / LSTM_BLOCK : p.padded / LSTM_BLOCK;
+    for (int kb = 0; kb < nb; kb++)
+        for (int h = 0; h < 2; h++)
+        {
+            // one half block (8 lanes) at a time, the panel is read twice
+            const float *bias = &p.bias[(size_t)kb * 4 * LSTM_BLOCK] + h * 8;
+            __m256 acc[NB][4];
+#pragma GCC unroll 4
+            for (int b = 0; b < NB; b++)
+                for (int g = 0; g < 4; g++)
+                    acc[b][g] = _mm256_load_ps(bias + g * LSTM_BLOCK);
+
+            const float *w = &p.w[(size_t)kb * 2 * H * 4 * LSTM_BLOCK] + h * 8;
+            w = accumulate_tile_avx2<HC, NB>(w, x_e, H, acc);
+            accumulate_tile_avx2<HC, NB>(w, s_prev, H, acc);
+
+#pragma GCC unroll 4
+            for (int b = 0; b < NB; b++)
+            {
+                float *ck = c[b] + kb * LSTM_BLOCK + h * 8;
+                float *sk = s[b] + kb * LSTM_BLOCK + h * 8;
+                __m256 i = hard_sigmoid_avx2(acc[b][0]);
+                __m256 f = hard_sigmoid_avx2(acc[b][1]);
+                __m256 o = hard_sigmoid_avx2(acc[b][2]);
+                __m256 g = tanh_avx2(acc[b][3]);
+                __m256 cc = _mm256_fmadd_ps(_mm256_loadu_ps(ck), f, _mm256_mul_ps(g, i));
+                _mm256_storeu_ps(ck, cc);
+                _mm256_storeu_ps(sk, _mm256_mul_ps(tanh_avx2(cc), o));
+            }
+        }
+}
+
+template <int NC, int NB>
+__attribute__((target("avx512f")))
+static inline const float *accumulate_tile_avx512(const float *w, const float *const *v, int n,
+                                                  __m512 (*acc)[4])
+{
+    if (NC)
+        n = NC;
+#pragma GCC unroll 2
+    for (int j = 0; j < n; j++, w += 4 * LSTM_BLOCK)
+    {
+        __m512 x[NB];
+#pragma GCC unroll 4
+        for (int b = 0; b < NB; b++)
+            x[b] = _mm512_set1_ps(v[b][j]);
+#pragma GCC unroll 4
+        for (int g = 0; g < 4; g++)
+        {
+            __m512 wg = _mm512_load_ps(w + g * LSTM_BLOCK);
+#pragma GCC unroll 4
+            for (int b = 0; b < NB; b++)
+                acc[b][g] = _mm512_fmadd_ps(wg, x[b], acc[b][g]);
+        }
+    }
+    return w;
+}
+
+template <int HC, int NB>
+__attribute__((target("avx512f")))
+static void lstm_tile_avx512(const LSTMPacked &p, const float *const *x_e,
+                             const float *const *s_prev, float *const *s, float *const *c)
+{
+    const int H = HC ? HC : p.hidden;
+    const int nb = HC ? (HC + LSTM_BLOCK - 1) / LSTM_BLOCK : p.padded / LSTM_BLOCK;
+    for (int kb = 0; kb < nb; kb++)
+    {
+        const float *bias = &p.bias[(size_t)kb * 4 * LSTM_BLOCK];
+        __m512 acc[NB][4];
+#pragma GCC unroll 4
+        for (int b = 0; b < NB; b++)
+            for (int g = 0; g < 4; g++)
+                acc[b][g] = _mm512_load_ps(bias + g * LSTM_BLOCK);
+
+        const float *w = &p.w[(size_t)kb * 2 * H * 4 * LSTM_BLOCK];
+        w = accumulate_tile_avx512<HC, NB>(w, x_e, H, acc);
+        accumulate_tile_avx512<HC, NB>(w, s_prev, H, acc);
+
+#pragma GCC unroll 4
+        for (int b = 0; b < NB; b++)
+        {
+            float *ck = c[b] + kb * LSTM_BLOCK;
+            float *sk = s[b] + kb * LSTM_BLOCK;
+            __m512 i = hard_sigmoid_avx512(acc[b][0]);
+            __m512 f = hard_sigmoid_avx512(acc[b][1]);
+            __m512 o = hard_sigmoid_avx512(acc[b][2]);
+            __m512 g = tanh_avx512(acc[b][3]);
+            __m512 cc = _mm512_fmadd_ps(_mm512_loadu_ps(ck), f, _mm512_mul_ps(g, i));
+            _mm512_storeu_ps(ck, cc);
+            _mm512_storeu_ps(sk, _mm512_mul_ps(tanh_avx512(cc), o));
+        }
+    }
+}
+
+#endif
+
+// whole tiles of TILE sequences, then one narrower tile for the rest
+#define LSTM_TILE_ARGS  p, x_e + b, s_prev + b, s + b, c + b
+#define LSTM_TILES(kernel, HC, TILE)                                    \
+    {                                                                   \
+        int b = 0;                                                      \
+        for (; b + TILE <= n; b += TILE)                                \
+            kernel<HC, TILE>(LSTM_TILE_ARGS);                           \
+        switch (n - b)                                                  \
+        {                                                               \
+            case 1: kernel<HC, 1>(LSTM_TILE_ARGS); break;               \
+            case 2: kernel<HC, (TILE > 2 ? 2 : 1)>(LSTM_TILE_ARGS); break; \
+            case 3: kernel<HC, (TILE > 3 ? 3 : 1)>(LSTM_TILE_ARGS); break; \
+            default: break;                                             \
+        }                                                               \
+    }
+
+template <int HC>
+static void lstm_step_batch_shaped(const LSTMPacked &p, int n, const float *const *x_e,
+                                   const float *const *s_prev, float *const *s, float *const *c)
+{
+#ifdef LSTM_X86
+    switch (lstm_isa())
+    {
+        case LSTM_ISA_AVX512: LSTM_TILES(lstm_tile_avx512, HC, LSTM_TILE_AVX512); return;
+        case LSTM_ISA_AVX2:   LSTM_TILES(lstm_tile_avx2, HC, LSTM_TILE_AVX2); return;
+        default: break;
+    }
+#endif
+    LSTM_TILES(lstm_tile_scalar, HC, LSTM_TILE_SCALAR);
+}
+
+void lstm_step_batch(const LSTMPacked &p, int n, const float *const *x_e,
+                     const float *const *s_prev, float *const *s, float *const *c)
+{
+    switch (p.hidden)
+    {
+        case LSTM_HIDDEN_OCTAVE:   lstm_step_batch_shaped<LSTM_HIDDEN_OCTAVE>(p, n, x_e, s_prev, s, c); return;
+        case LSTM_HIDDEN_KEYBOARD: lstm_step_batch_shaped<LSTM_HIDDEN_KEYBOARD>(p, n, x_e, s_prev, s, c); return;
+        default:                   lstm_step_batch_shaped<0>(p, n, x_e, s_prev, s, c); return;
+    }
+}
@@ -0,0 +1,189 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Hot loops of the LSTM forward pass.
+//
+// The recurrent step works on a packed copy of U, W and b: the hidden
+// units are split into blocks of LSTM_BLOCK lanes and, for every block,
+// the rows of the four gates are interleaved column by column, i.e.
+//
+//   [block][input j in x_e|s_prev][gate i,f,o,g][lane]
+//
+// so one pass over the 2*hidden inputs produces all four pre-activations
+// of a block in registers, where the activations and the cell update are
+// applied before anything is written back.
+
+#ifndef LSTM_KERNELS_H
+#define LSTM_KERNELS_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// lanes per block: one 64 byte cache line of floats
+#define LSTM_BLOCK      16
+#define LSTM_ALIGN      64
+
+// model sizes with compile-time specialized kernels, any other shape
+// runs the generic ones
+#define LSTM_HIDDEN_OCTAVE      100     // 12 notes, rnn_LSTM_CPU.py
+#define LSTM_OUTPUT_OCTAVE      12
+#define LSTM_HIDDEN_KEYBOARD    128     // 88 keys
+#define LSTM_OUTPUT_KEYBOARD    88
+
+template <typename T>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    AlignedAllocator() { }
+    template <typename U> AlignedAllocator(const AlignedAllocator<U> &) { }
+
+    T *allocate(size_t n)
+    {
+        void *p = NULL;
+        if (posix_memalign(&p, LSTM_ALIGN, n * sizeof(T)) != 0)
+            throw std::bad_alloc();
+        return (T *)p;
+    }
+
+    void deallocate(T *p, size_t) { free(p); }
+
+    template <typename U> struct rebind { typedef AlignedAllocator<U> other; };
+};
+
+template <typename T, typename U>
+bool operator==(const AlignedAllocator<T> &, const AlignedAllocator<U> &) { return true; }
+template <typename T, typename U>
+bool operator!=(const AlignedAllocator<T> &, const AlignedAllocator<U> &) { return false; }
+
+typedef std::vector<float, AlignedAllocator<float> > AlignedFloats;
+typedef std::vector<signed char, AlignedAllocator<signed char> > AlignedInt8;
+
+// read-only weights, either built in memory or living inside a mapped
+// weight blob (see weight_blob.h). Copies share the same memory, which is
+// kept alive for as long as any of them exists.
+template <typename T>
+class SharedWeights
+{
+public:
+    typedef std::vector<T, AlignedAllocator<T> > Buffer;
+
+    SharedWeights() : p(NULL), n(0) { }
+
+    // take over a freshly built buffer
+    explicit SharedWeights(Buffer &&built)
+    {
+        std::shared_ptr<Buffer> b = std::make_shared<Buffer>(std::move(built));
+        p = b->empty() ? NULL : &(*b)[0];
+        n = b->size();
+        owner = b;
+    }
+
+    // n elements at p, which stay valid while owner does
+    SharedWeights(const T *p, size_t n, const std::shared_ptr<const void> &owner) :
+        owner(owner), p(p), n(n) { }
+
+    const T &operator[](size_t i) const { return p[i]; }
+    const T *data() const { return p; }
+    size_t size() const { return n; }
+    bool empty() const { return n == 0; }
+
+protected:
+    std::shared_ptr<const void> owner;
+    const T *p;
+    size_t n;
+};
+
+enum LSTMIsa
+{
+    LSTM_ISA_SCALAR,
+    LSTM_ISA_AVX2,
+    LSTM_ISA_AVX512
+};
+
+// best instruction set supported by this CPU, or the one forced
+// through lstm_set_isa()
+LSTMIsa lstm_isa();
+void lstm_set_isa(LSTMIsa isa);
+const char *lstm_isa_name(LSTMIsa isa);
+
+struct LSTMPacked
+{
+    int hidden;         // real number of hidden units
+    int padded;         // hidden rounded up to LSTM_BLOCK
+    SharedWeights<float> w;     // (padded/LSTM_BLOCK, 2*hidden, 4, LSTM_BLOCK)
+    SharedWeights<float> bias;  // (padded/LSTM_BLOCK, 4, LSTM_BLOCK)
+};
+
+// pack the (4, hidden, hidden) U and W tensors and the (4, hidden) biases
+void lstm_pack(const float *U, const float *W, const float *b, int hidden,
+               LSTMPacked &p);
+
+// input projection of all T frames at once, X_e = X.dot(A.T): X is
+// (T, cols), A is (rows, cols) and X_e is (T, ld) with ld >= rows.
+// The rows of A are split over `threads` threads (0 = one per core) and
+// every cache block of A is reused for four frames at a time, so A is
+// streamed from memory once per song instead of once per frame.
+void lstm_project(const float *A, const float *X, int T, int rows, int cols,
+                  float *X_e, int ld, int threads);
+
+// column major copy of A for the sparse input projection: column k holds
+// the weights of input bin k for all rows, padded to a whole cache line
+struct LSTMColumns
+{
+    int rows;
+    int cols;
+    int ld;                     // rows rounded up to LSTM_BLOCK
+    SharedWeights<float> w;     // (cols, ld)
+};
+
+void lstm_pack_columns(const float *A, int rows, int cols, LSTMColumns &c);
+
+// pick the active bins of a frame: |x[k]| >= threshold, and if top_k > 0
+// only the top_k largest of those. Writes their indices (ascending) to
+// idx, which must hold cols entries, and returns how many there are.
+int lstm_active_bins(const float *x, int cols, float threshold, int top_k, int *idx);
+
+// x_e = A.dot(x) over the n selected bins only; x_e must hold c.ld floats
+void lstm_project_sparse(const LSTMColumns &c, const float *x, const int *idx, int n,
+                         float *x_e);
+
+// per-row symmetric int8 copy of A: A[r][k] ~= scale[r] * w[r][k]
+struct LSTMInt8
+{
+    int rows;
+    int cols;
+    int ld;                         // cols rounded up to LSTM_ALIGN, zero filled
+    SharedWeights<signed char> w;   // (rows, ld)
+    SharedWeights<float> scale;     // (rows)
+};
+
+void lstm_quantize_rows(const float *A, int rows, int cols, LSTMInt8 &q);
+
+// same as lstm_project() on the int8 copy: every frame is quantized to
+// int8 with its own scale and the dot products run in int32
+void lstm_project_int8(const LSTMInt8 &q, const float *X, int T,
+                       float *X_e, int ld, int threads);
+
+// one recurrent step: x_e is the projected input (hidden), s_prev the
+// previous hidden state (padded); writes the new state to s (padded) and
+// updates the cell c (padded) in place. s must not alias s_prev.
+// Dispatches on p.hidden to a specialized kernel when there is one.
+void lstm_step(const LSTMPacked &p, const float *x_e, const float *s_prev,
+               float *s, float *c);
+
+// whether lstm_step() has a specialized kernel for this hidden size
+bool lstm_step_specialized(int hidden);
+
+// lstm_step() for n independent sequences at once: sequence b reads
+// x_e[b] and s_prev[b], writes s[b] and updates c[b]. Every load of a
+// weight panel is shared by a tile of sequences, so the recurrent
+// products run as small GEMMs. Finished sequences are masked by leaving
+// them out of the pointer arrays.
+void lstm_step_batch(const LSTMPacked &p, int n, const float *const *x_e,
+                     const float *const *s_prev, float *const *s, float *const *c);
+
+#endif
@@ -0,0 +1,79 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Viterbi note smoothing, see note_decoder.h.
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "note_decoder.h"
+
+using namespace std;
+
+vector<int> viterbi_smooth(const float *probs, int T, int O, double switch_penalty)
+{
+    if (T <= 0)
+        return vector<int>();
+    if (O <= 0 || switch_penalty < 0.0)
+        throw runtime_error("decoder: bad note count or negative switch penalty");
+
+    // score[k] is the best log probability of a path ending in note k;
+    // from[t][k] remembers where that path was at t-1. Switching costs
+    // the same from every note, so the best predecessor is either k
+    // itself or the overall best of the previous frame: O(T*O).
+    vector<double> score(O), next(O);
+    vector<int> from((size_t)T * O);
+    for (int k = 0; k < O; k++)
+    {
+        score[k] = log(max((double)probs[k], DECODER_FLOOR));
+        from[k] = k;
+    }
+
+    for (int t = 1; t < T; t++)
+    {
+        int best = (int)(max_element(score.begin(), score.end()) - score.begin());
+        double jump = score[best] - switch_penalty;
+        const float *p = probs + (size_t)t * O;
+        for (int k = 0; k < O; k++)
+        {
+            bool stay = score[k] >= jump;
+            next[k] = (stay ? score[k] : jump) + log(max((double)p[k], DECODER_FLOOR));
+            from[(size_t)t * O + k] = stay ? k : best;
+        }
+        score.swap(next);
+    }
+
+    vector<int> path(T);
+    path[T - 1] = (int)(max_element(score.begin(), score.end()) - score.begin());
+    for (int t = T - 1; t > 0; t--)
+        path[t - 1] = from[(size_t)t * O + path[t]];
+    return path;
+}
+
+vector<NoteEvent> note_events(const vector<int> &path, const float *probs, int O)
+{
+    vector<NoteEvent> events;
+    for (int t = 0; t < (int)path.size(); t++)
+    {
+        float p = probs ? probs[(size_t)t * O + path[t]] : 1.0f;
+        if (!events.empty() && events.back().note == path[t])
+        {
+            NoteEvent &e = events.back();
+            e.confidence += (p - e.confidence) / (e.duration + 1);
+            e.duration++;
+            continue;
+        }
+        NoteEvent e;
+        e.note = path[t];
+        e.onset = t;
+        e.duration = 1;
+        e.confidence = p;
+        events.push_back(e);
+    }
+    return events;
+}
+
+vector<NoteEvent> decode_notes(const float *probs, int T, int O, double switch_penalty)
+{
+    return note_events(viterbi_smooth(probs, T, O, switch_penalty), probs, O);
+}
@@ -0,0 +1,40 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Turns the per-frame softmax output of the LSTM into note events.
+//
+// The raw argmax flickers between notes on noisy recordings, and every
+// flicker costs the robot a full up/down/up stroke. The decoder treats
+// the 12 notes as the states of an HMM whose emissions are the softmax
+// probabilities; changing note costs switch_penalty nats on top of the
+// emission, so a new note has to be more likely over enough frames to
+// pay for the change. The Viterbi path is then cut into runs, one event
+// per run.
+
+#ifndef NOTE_DECODER_H
+#define NOTE_DECODER_H
+
+#include <vector>
+
+// switch_penalty = 0 keeps the argmax path and only merges repeats
+#define DECODER_SWITCH_PENALTY  0.0     // [nats]
+#define DECODER_FLOOR           1e-12   // probability floor before the log
+
+struct NoteEvent
+{
+    int note;
+    int onset;          // first frame
+    int duration;       // frames
+    float confidence;   // mean probability of the note over the event
+};
+
+// most likely note sequence for the (T, O) probabilities
+std::vector<int> viterbi_smooth(const float *probs, int T, int O, double switch_penalty);
+
+// one event per run of equal notes; probs may be NULL, confidence is 1 then
+std::vector<NoteEvent> note_events(const std::vector<int> &path, const float *probs, int O);
+
+// viterbi_smooth() followed by note_events()
+std::vector<NoteEvent> decode_notes(const float *probs, int T, int O,
+                                    double switch_penalty = DECODER_SWITCH_PENALTY);
+
+#endif
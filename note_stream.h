@@ -0,0 +1,143 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Binary framing of the note sequence that call_python sends to the
+// controller over its stdout pipe, and rnn_server sends in reply to
+// DECODE. Everything is little endian:
+//
+//   header  "NOTE" | u16 version | u16 flags | u32 count
+//   count x record  i32 note | f32 confidence | u32 onset | u32 duration
+//
+// confidence is only meaningful with NOTE_STREAM_CONFIDENCE set, onset
+// and duration (in frames) only with NOTE_STREAM_TIMING set.
+//
+// Header only, so call_python can use it without linking rnn_lstm.
+
+#ifndef NOTE_STREAM_H
+#define NOTE_STREAM_H
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+#include <vector>
+
+#define NOTE_STREAM_MAGIC       "NOTE"
+#define NOTE_STREAM_VERSION     1
+#define NOTE_STREAM_CONFIDENCE  0x0001
+#define NOTE_STREAM_TIMING      0x0002
+
+#define NOTE_STREAM_HEADER_SIZE 12
+#define NOTE_STREAM_RECORD_SIZE 16
+#define NOTE_STREAM_RESERVE     4096    // records reserved before they arrive
+
+struct NoteRecord
+{
+    int32_t note;
+    float confidence;
+    uint32_t onset;
+    uint32_t duration;
+};
+
+inline void note_stream_put_u32(char *p, uint32_t v)
+{
+    p[0] = (char)(v & 0xff);
+    p[1] = (char)((v >> 8) & 0xff);
+    p[2] = (char)((v >> 16) & 0xff);
+    p[3] = (char)((v >> 24) & 0xff);
+}
+
+inline uint32_t note_stream_get_u32(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return u[0] | (u[1] << 8) | (u[2] << 16) | ((uint32_t)u[3] << 24);
+}
+
+// header and records as one buffer
+inline std::vector<char> note_stream_encode(const std::vector<NoteRecord> &notes, uint16_t flags)
+{
+    std::vector<char> buf(NOTE_STREAM_HEADER_SIZE + notes.size() * NOTE_STREAM_RECORD_SIZE);
+    memcpy(&buf[0], NOTE_STREAM_MAGIC, 4);
+    buf[4] = (char)(NOTE_STREAM_VERSION & 0xff);
+    buf[5] = (char)(NOTE_STREAM_VERSION >> 8);
+    buf[6] = (char)(flags & 0xff);
+    buf[7] = (char)(flags >> 8);
+    note_stream_put_u32(&buf[8], (uint32_t)notes.size());
+
+    for (size_t j = 0; j < notes.size(); j++)
+    {
+        char *r = &buf[NOTE_STREAM_HEADER_SIZE + j * NOTE_STREAM_RECORD_SIZE];
+        uint32_t conf;
+        memcpy(&conf, &notes[j].confidence, 4);
+        note_stream_put_u32(r, (uint32_t)notes[j].note);
+        note_stream_put_u32(r + 4, conf);
+        note_stream_put_u32(r + 8, notes[j].onset);
+        note_stream_put_u32(r + 12, notes[j].duration);
+    }
+    return buf;
+}
+
+// write header and records in one go, returns false on a short write
+inline bool note_stream_write(FILE *out, const std::vector<NoteRecord> &notes, uint16_t flags)
+{
+    std::vector<char> buf = note_stream_encode(notes, flags);
+    return fwrite(&buf[0], 1, buf.size(), out) == buf.size();
+}
+
+// incremental reader: feed() whatever chunk arrived from the pipe, the
+// records are decoded as soon as they are complete
+class NoteStreamReader
+{
+public:
+    NoteStreamReader() : flags(0), count(0), header(false) { }
+
+    void feed(const char *data, size_t len)
+    {
+        pending.insert(pending.end(), data, data + len);
+
+        size_t used = 0;
+        if (!header)
+        {
+            if (pending.size() < NOTE_STREAM_HEADER_SIZE)
+                return;
+            if (memcmp(&pending[0], NOTE_STREAM_MAGIC, 4) != 0)
+                throw std::runtime_error("note stream: bad magic");
+            unsigned int version = (unsigned char)pending[4] | ((unsigned char)pending[5] << 8);
+            if (version != NOTE_STREAM_VERSION)
+                throw std::runtime_error("note stream: unsupported version");
+            flags = (unsigned char)pending[6] | ((unsigned char)pending[7] << 8);
+            count = note_stream_get_u32(&pending[8]);
+            // count comes off the pipe: only a sane number is reserved up
+            // front, push_back grows the vector as records really arrive
+            records.reserve(count < NOTE_STREAM_RESERVE ? count : NOTE_STREAM_RESERVE);
+            header = true;
+            used = NOTE_STREAM_HEADER_SIZE;
+        }
+
+        while (records.size() < count && pending.size() - used >= NOTE_STREAM_RECORD_SIZE)
+        {
+            const char *r = &pending[used];
+            NoteRecord rec;
+            uint32_t conf = note_stream_get_u32(r + 4);
+            rec.note = (int32_t)note_stream_get_u32(r);
+            memcpy(&rec.confidence, &conf, 4);
+            rec.onset = note_stream_get_u32(r + 8);
+            rec.duration = note_stream_get_u32(r + 12);
+            records.push_back(rec);
+            used += NOTE_STREAM_RECORD_SIZE;
+        }
+        pending.erase(pending.begin(), pending.begin() + used);
+    }
+
+    // true once the header and all announced records were read
+    bool complete() const { return header && records.size() == count; }
+
+    uint16_t flags;
+    uint32_t count;
+    std::vector<NoteRecord> records;
+
+protected:
+    bool header;
+    std::vector<char> pending;
+};
+
+#endif
@@ -0,0 +1,609 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Minimal .npy/.npz reader and writer, see npz.h.
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef NPZ_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "npz.h"
+
+using namespace std;
+
+static unsigned int read_u16(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return u[0] | (u[1] << 8);
+}
+
+static unsigned int read_u32(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return u[0] | (u[1] << 8) | (u[2] << 16) | ((unsigned int)u[3] << 24);
+}
+
+static unsigned long long read_u64(const char *p)
+{
+    return read_u32(p) | ((unsigned long long)read_u32(p + 4) << 32);
+}
+
+size_t NpyArray::size() const
+{
+    size_t n = 1;
+    for (size_t i = 0; i < shape.size(); i++)
+        n *= shape[i];
+    return n;
+}
+
+template <typename T>
+static T element(const NpyArray &a, size_t i)
+{
+    const char *p = &a.data[i * a.word_size];
+    if (a.kind == 'f')
+    {
+        if (a.word_size == 8)
+        {
+            double v;
+            memcpy(&v, p, 8);
+            return (T)v;
+        }
+        if (a.word_size == 4)
+        {
+            float v;
+            memcpy(&v, p, 4);
+            return (T)v;
+        }
+    }
+    else if (a.kind == 'i' || a.kind == 'u' || a.kind == 'b')
+    {
+        long long v = 0;
+        switch (a.word_size)
+        {
+            case 1: v = (a.kind == 'i') ? (long long)(signed char)*p : (long long)(unsigned char)*p; break;
+            case 2: { short s; memcpy(&s, p, 2); v = (a.kind == 'i') ? s : (unsigned short)s; } break;
+            case 4: { int s; memcpy(&s, p, 4); v = (a.kind == 'i') ? s : (unsigned int)s; } break;
+            case 8: memcpy(&v, p, 8); break;
+        }
+        return (T)v;
+    }
+    throw runtime_error("npy: unsupported dtype");
+}
+
+template <typename T>
+static vector<T> convert(const NpyArray &a)
+{
+    size_t n = a.size();
+    vector<T> out(n);
+    if (!a.fortran_order || a.shape.size() < 2)
+    {
+        for (size_t i = 0; i < n; i++)
+            out[i] = element<T>(a, i);
+        return out;
+    }
+
+    // fortran order: walk the C-order index and map it onto column major
+    vector<size_t> idx(a.shape.size(), 0);
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t f = 0, stride = 1;
+        for (size_t d = 0; d < a.shape.size(); d++)
+        {
+            f += idx[d] * stride;
+            stride *= a.shape[d];
+        }
+        out[i] = element<T>(a, f);
+        for (int d = (int)a.shape.size() - 1; d >= 0; d--)
+        {
+            if (++idx[d] < a.shape[d])
+                break;
+            idx[d] = 0;
+        }
+    }
+    return out;
+}
+
+vector<float> NpyArray::as_float() const
+{
+    return convert<float>(*this);
+}
+
+vector<double> NpyArray::as_double() const
+{
+    return convert<double>(*this);
+}
+
+// value of key in the header dict, up to the next top level comma
+static string header_value(const string &header, const string &key)
+{
+    size_t p = header.find("'" + key + "'");
+    if (p == string::npos)
+        throw runtime_error("npy: header has no " + key);
+    p = header.find(':', p);
+    if (p == string::npos)
+        throw runtime_error("npy: malformed header");
+    p = header.find_first_not_of(' ', p + 1);
+    if (p == string::npos)
+        throw runtime_error("npy: malformed header");
+
+    size_t end = p;
+    int depth = 0;
+    for (; end < header.size(); end++)
+    {
+        char ch = header[end];
+        if (ch == '(')
+            depth++;
+        else if (ch == ')')
+            depth--;
+        else if ((ch == ',' || ch == '}') && depth == 0)
+            break;
+    }
+    return header.substr(p, end - p);
+}
+
+NpyArray npy_parse(const char *buf, size_t len)
+{
+    if (len < 10 || memcmp(buf, "\x93NUMPY", 6) != 0)
+        throw runtime_error("npy: bad magic");
+
+    int major = (unsigned char)buf[6];
+    size_t header_len, header_start;
+    if (major == 1)
+    {
+        header_len = read_u16(buf + 8);
+        header_start = 10;
+    }
+    else if (major == 2 || major == 3)
+    {
+        if (len < 12)
+            throw runtime_error("npy: truncated header");
+        header_len = read_u32(buf + 8);
+        header_start = 12;
+    }
+    else
+        throw runtime_error("npy: unsupported format version");
+    if (header_start + header_len > len)
+        throw runtime_error("npy: truncated header");
+
+    string header(buf + header_start, header_len);
+    size_t last = header.find_last_not_of(" \n");
+    if (header.empty() || header[0] != '{' || last == string::npos || header[last] != '}' ||
+        header[header.size() - 1] != '\n')
+        throw runtime_error("npy: malformed header");
+    NpyArray a;
+
+    // descr, e.g. '<f8'; only little endian or byte sized types
+    string descr = header_value(header, "descr");
+    if (descr.size() < 5 || descr[0] != '\'' || descr[descr.size() - 1] != '\'')
+        throw runtime_error("npy: unsupported descr " + descr);
+    descr = descr.substr(1, descr.size() - 2);
+    a.kind = descr[1];
+    char *end;
+    a.word_size = strtoul(descr.c_str() + 2, &end, 10);
+    bool sized = (a.word_size == 1 || a.word_size == 2 || a.word_size == 4 || a.word_size == 8);
+    bool order = (descr[0] == '<' || descr[0] == '=' || (descr[0] == '|' && a.word_size == 1));
+    bool known = (a.kind == 'i' || a.kind == 'u' || a.kind == 'b' ||
+                  (a.kind == 'f' && (a.word_size == 4 || a.word_size == 8)));
+    if (*end || !sized || !order || !known)
+        throw runtime_error("npy: unsupported descr " + descr);
+
+    string fortran = header_value(header, "fortran_order");
+    if (fortran == "True")
+        a.fortran_order = true;
+    else if (fortran == "False")
+        a.fortran_order = false;
+    else
+        throw runtime_error("npy: bad fortran_order " + fortran);
+
+    string dims = header_value(header, "shape");
+    if (dims.size() < 2 || dims[0] != '(' || dims[dims.size() - 1] != ')')
+        throw runtime_error("npy: bad shape " + dims);
+    const char *c = dims.c_str() + 1;
+    while (*c != ')')
+    {
+        if (*c == ' ' || *c == ',')
+        {
+            c++;
+            continue;
+        }
+        unsigned long long v = strtoull(c, &end, 10);
+        if (end == c || (*end != ',' && *end != ')' && *end != ' '))
+            throw runtime_error("npy: bad shape " + dims);
+        a.shape.push_back((size_t)v);
+        c = end;
+    }
+
+    size_t n = 1;
+    for (size_t i = 0; i < a.shape.size(); i++)
+    {
+        if (a.shape[i] && n > SIZE_MAX / a.shape[i])
+            throw runtime_error("npy: shape overflows");
+        n *= a.shape[i];
+    }
+    if (n > SIZE_MAX / a.word_size)
+        throw runtime_error("npy: shape overflows");
+
+    a.bytes = n * a.word_size;
+    size_t data_start = header_start + header_len;
+    if (a.bytes > len - data_start)
+        throw runtime_error("npy: truncated data");
+    a.data = buf + data_start;
+    return a;
+}
+
+#ifdef NPZ_HAVE_ZLIB
+// inflate a raw deflate stream straight into its final buffer, feeding
+// zlib in bounded chunks so members beyond 4 GB work too
+static void inflate_member(const char *in, size_t in_len, char *out, size_t out_len,
+                           const string &name)
+{
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (inflateInit2(&z, -MAX_WBITS) != Z_OK)
+        throw runtime_error("npz: cannot initialise zlib");
+
+    const size_t chunk = (size_t)1 << 30;
+    size_t done_in = 0, done_out = 0;
+    int ret = Z_OK;
+    while (ret != Z_STREAM_END)
+    {
+        if (z.avail_in == 0 && done_in < in_len)
+        {
+            z.next_in = (Bytef *)(in + done_in);
+            z.avail_in = (uInt)min(chunk, in_len - done_in);
+            done_in += z.avail_in;
+        }
+        if (z.avail_out == 0 && done_out < out_len)
+        {
+            z.next_out = (Bytef *)(out + done_out);
+            z.avail_out = (uInt)min(chunk, out_len - done_out);
+            done_out += z.avail_out;
+        }
+        ret = inflate(&z, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END)
+            break;
+        if (ret == Z_OK && z.avail_in == 0 && done_in == in_len &&
+            z.avail_out == 0 && done_out == out_len)
+        {
+            ret = Z_DATA_ERROR;
+            break;
+        }
+    }
+    size_t total = (size_t)z.total_out;
+    inflateEnd(&z);
+    if (ret != Z_STREAM_END || total != out_len)
+        throw runtime_error("npz: corrupt deflated member " + name);
+}
+#endif
+
+NpzFile::NpzFile(const string &filename) : filename(filename), mapping(NULL), length(0)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw runtime_error("npz: cannot open " + filename);
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < 22)
+    {
+        close(fd);
+        throw runtime_error("npz: " + filename + " is not a zip archive");
+    }
+    length = (size_t)st.st_size;
+    void *m = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED)
+        throw runtime_error("npz: cannot map " + filename);
+    mapping = (char *)m;
+
+    try
+    {
+        const char *buf = mapping;
+
+        // locate the end of central directory record
+        size_t eocd = length - 22;
+        while (read_u32(&buf[eocd]) != 0x06054b50)
+        {
+            if (eocd == 0)
+                throw runtime_error("npz: " + filename + " is not a zip archive");
+            eocd--;
+        }
+
+        unsigned int entries = read_u16(&buf[eocd + 10]);
+        size_t cd = read_u32(&buf[eocd + 16]);
+        inflated.reserve(entries);
+
+        for (unsigned int e = 0; e < entries; e++)
+        {
+            if (cd + 46 > length || read_u32(&buf[cd]) != 0x02014b50)
+                throw runtime_error("npz: corrupt central directory in " + filename);
+
+            unsigned int method = read_u16(&buf[cd + 10]);
+            unsigned long long comp_size = read_u32(&buf[cd + 20]);
+            unsigned long long size = read_u32(&buf[cd + 24]);
+            unsigned int name_len = read_u16(&buf[cd + 28]);
+            unsigned int extra_len = read_u16(&buf[cd + 30]);
+            unsigned int comment_len = read_u16(&buf[cd + 32]);
+            unsigned long long local = read_u32(&buf[cd + 42]);
+            if (cd + 46 + name_len + extra_len > length)
+                throw runtime_error("npz: corrupt central directory in " + filename);
+            string name(&buf[cd + 46], name_len);
+
+            // zip64 extra field, written by np.savez for large members; a
+            // value that does not fit in the field stays 0xffffffff and
+            // fails the member checks below
+            const char *extra = &buf[cd + 46 + name_len];
+            for (unsigned int x = 0; x + 4 <= extra_len; )
+            {
+                unsigned int id = read_u16(extra + x);
+                unsigned int len = read_u16(extra + x + 2);
+                if (x + 4 + len > extra_len)
+                    throw runtime_error("npz: corrupt central directory in " + filename);
+                if (id == 0x0001)
+                {
+                    const char *z = extra + x + 4;
+                    const char *end = z + len;
+                    if (size == 0xffffffffULL && z + 8 <= end)      { size = read_u64(z); z += 8; }
+                    if (comp_size == 0xffffffffULL && z + 8 <= end) { comp_size = read_u64(z); z += 8; }
+                    if (local == 0xffffffffULL && z + 8 <= end)     { local = read_u64(z); }
+                }
+                x += 4 + len;
+            }
+            cd += 46 + name_len + extra_len + comment_len;
+
+            if (local + 30 > length)
+                throw runtime_error("npz: truncated member " + name);
+            size_t start = local + 30 + read_u16(&buf[local + 26]) + read_u16(&buf[local + 28]);
+            unsigned long long stored = (method == 0) ? size : comp_size;
+            if (start > length || stored > length - start)
+                throw runtime_error("npz: truncated member " + name);
+
+            const char *member = &buf[start];
+            if (method == 8)
+            {
+#ifdef NPZ_HAVE_ZLIB
+                inflated.push_back(vector<char>((size_t)size));
+                vector<char> &out = inflated.back();
+                if (size)
+                    inflate_member(member, (size_t)comp_size, &out[0], (size_t)size, name);
+                member = size ? &out[0] : NULL;
+#else
+                throw runtime_error("npz: deflated member " + name +
+                                    " needs zlib, rebuild with NPZ_HAVE_ZLIB");
+#endif
+            }
+            else if (method != 0)
+                throw runtime_error("npz: unsupported compression in member " + name);
+
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".npy") == 0)
+                name.erase(name.size() - 4);
+            try
+            {
+                members[name] = npy_parse(member, (size_t)size);
+            }
+            catch (const exception &ex)
+            {
+                throw runtime_error(filename + ": " + name + ": " + ex.what());
+            }
+        }
+    }
+    catch (...)
+    {
+        munmap(mapping, length);
+        throw;
+    }
+}
+
+NpzFile::~NpzFile()
+{
+    munmap(mapping, length);
+}
+
+bool NpzFile::has(const string &name) const
+{
+    return members.find(name) != members.end();
+}
+
+const NpyArray &NpzFile::operator[](const string &name) const
+{
+    map<string, NpyArray>::const_iterator it = members.find(name);
+    if (it == members.end())
+        throw runtime_error(filename + ": missing array " + name);
+    return it->second;
+}
+
+static void put_u16(char *p, unsigned int v)
+{
+    p[0] = (char)(v & 0xff);
+    p[1] = (char)((v >> 8) & 0xff);
+}
+
+static void put_u32(char *p, unsigned int v)
+{
+    put_u16(p, v & 0xffff);
+    put_u16(p + 2, v >> 16);
+}
+
+static uint32_t crc32_update(uint32_t crc, const char *data, size_t len)
+{
+    static uint32_t table[256];
+    static bool ready = false;
+    if (!ready)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        ready = true;
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++)
+        crc = table[(crc ^ (unsigned char)data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// zip local file header with crc and sizes, rewritten once they are known
+static void local_header(char *h, const string &name, uint32_t crc, unsigned int size)
+{
+    put_u32(h, 0x04034b50);
+    put_u16(h + 4, 20);             // version needed
+    put_u16(h + 6, 0);              // flags
+    put_u16(h + 8, 0);              // stored
+    put_u16(h + 10, 0);             // time
+    put_u16(h + 12, 0x21);          // date, 1980-01-01
+    put_u32(h + 14, crc);
+    put_u32(h + 18, size);
+    put_u32(h + 22, size);
+    put_u16(h + 26, (unsigned int)name.size());
+    put_u16(h + 28, 0);
+}
+
+NpzWriter::NpzWriter(const string &filename) :
+    filename(filename), f(NULL), in_member(false), expected(0)
+{
+    f = fopen(filename.c_str(), "wb");
+    if (!f)
+        throw runtime_error("npz: cannot create " + filename);
+}
+
+NpzWriter::~NpzWriter()
+{
+    if (f)
+        fclose(f);
+}
+
+void NpzWriter::begin(const string &name, char kind, size_t word_size,
+                      const vector<size_t> &shape)
+{
+    if (!f || in_member)
+        throw runtime_error("npz: begin() while " + filename + " is not ready for a member");
+
+    // npy v1 header, padded so the payload starts on a 64 byte boundary
+    // of the .npy as numpy does
+    char descr[8];
+    snprintf(descr, sizeof(descr), "%c%c%u", word_size == 1 ? '|' : '<', kind,
+             (unsigned int)word_size);
+    string dict = string("{'descr': '") + descr + "', 'fortran_order': False, 'shape': (";
+    expected = word_size;
+    for (size_t i = 0; i < shape.size(); i++)
+    {
+        char dim[32];
+        snprintf(dim, sizeof(dim), "%llu,%s", (unsigned long long)shape[i],
+                 (i + 1 < shape.size()) ? " " : "");
+        dict += dim;
+        expected *= shape[i];
+    }
+    if (shape.size() > 1)
+        dict.erase(dict.size() - 1);
+    dict += "), }";
+    size_t total = 10 + dict.size() + 1;
+    dict.append((64 - total % 64) % 64, ' ');
+    dict += '\n';
+
+    Entry e;
+    e.name = name + ".npy";
+    e.crc = 0;
+    e.size = 0;
+    e.offset = (unsigned long long)ftello(f);
+    if (e.offset > 0xffffffffULL)
+        throw runtime_error("npz: " + filename + " exceeds 4 GB, zip64 is not written");
+
+    char h[30];
+    local_header(h, e.name, 0, 0);
+    if (fwrite(h, 1, 30, f) != 30 || fwrite(e.name.data(), 1, e.name.size(), f) != e.name.size())
+        throw runtime_error("npz: cannot write " + filename);
+    entries.push_back(e);
+    in_member = true;
+
+    char npy[10];
+    memcpy(npy, "\x93NUMPY\x01\x00", 8);
+    put_u16(npy + 8, (unsigned int)dict.size());
+    write(npy, 10);
+    write(dict.data(), dict.size());
+    expected += 10 + dict.size();
+}
+
+void NpzWriter::write(const void *data, size_t bytes)
+{
+    if (!in_member)
+        throw runtime_error("npz: write() outside a member of " + filename);
+    Entry &e = entries.back();
+    if (fwrite(data, 1, bytes, f) != bytes)
+        throw runtime_error("npz: cannot write " + filename);
+    e.crc = crc32_update(e.crc, (const char *)data, bytes);
+    e.size += bytes;
+}
+
+void NpzWriter::end()
+{
+    if (!in_member)
+        throw runtime_error("npz: end() outside a member of " + filename);
+    Entry &e = entries.back();
+    if (e.size != expected)
+        throw runtime_error("npz: member " + e.name + " does not match its shape");
+    if (e.size > 0xffffffffULL)
+        throw runtime_error("npz: member " + e.name + " exceeds 4 GB, zip64 is not written");
+
+    off_t here = ftello(f);
+    char h[30];
+    local_header(h, e.name, e.crc, (unsigned int)e.size);
+    if (fseeko(f, (off_t)e.offset, SEEK_SET) != 0 || fwrite(h, 1, 30, f) != 30 ||
+        fseeko(f, here, SEEK_SET) != 0)
+        throw runtime_error("npz: cannot write " + filename);
+    in_member = false;
+}
+
+void NpzWriter::close()
+{
+    if (!f)
+        return;
+    if (in_member)
+        throw runtime_error("npz: close() inside a member of " + filename);
+
+    unsigned long long cd = (unsigned long long)ftello(f);
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const Entry &e = entries[i];
+        char h[46];
+        memset(h, 0, sizeof(h));
+        put_u32(h, 0x02014b50);
+        put_u16(h + 4, 20);         // version made by
+        put_u16(h + 6, 20);         // version needed
+        put_u16(h + 14, 0x21);
+        put_u32(h + 16, e.crc);
+        put_u32(h + 20, (unsigned int)e.size);
+        put_u32(h + 24, (unsigned int)e.size);
+        put_u16(h + 28, (unsigned int)e.name.size());
+        put_u32(h + 42, (unsigned int)e.offset);
+        if (fwrite(h, 1, 46, f) != 46 || fwrite(e.name.data(), 1, e.name.size(), f) != e.name.size())
+            throw runtime_error("npz: cannot write " + filename);
+    }
+    unsigned long long cd_end = (unsigned long long)ftello(f);
+    if (cd_end > 0xffffffffULL)
+        throw runtime_error("npz: " + filename + " exceeds 4 GB, zip64 is not written");
+
+    char eocd[22];
+    memset(eocd, 0, sizeof(eocd));
+    put_u32(eocd, 0x06054b50);
+    put_u16(eocd + 8, (unsigned int)entries.size());
+    put_u16(eocd + 10, (unsigned int)entries.size());
+    put_u32(eocd + 12, (unsigned int)(cd_end - cd));
+    put_u32(eocd + 16, (unsigned int)cd);
+    bool ok = fwrite(eocd, 1, 22, f) == 22;
+    ok = (fclose(f) == 0) && ok;
+    f = NULL;
+    if (!ok)
+        throw runtime_error("npz: cannot write " + filename);
+}
@@ -0,0 +1,166 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Minimal reader for numpy .npy arrays stored inside .npz archives,
+// enough to load the parameter files written by np.savez and the
+// dirty_example_*.npz spectral datasets.
+//
+// The archive is memory mapped and stored (np.savez) members are used in
+// place: an NpyArray only points into the mapping, nothing is decoded or
+// copied until a caller asks for it. Deflated (np.savez_compressed)
+// members are inflated once into a buffer owned by the NpzFile, which
+// needs zlib (NPZ_HAVE_ZLIB). NpzWriter produces stored archives.
+
+#ifndef NPZ_H
+#define NPZ_H
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// read-only typed view of npy payload bytes. The payload of a stored
+// member sits wherever the zip put it, so it is not necessarily aligned
+// for T: operator[] is always safe, data() only when aligned() is true.
+template <typename T>
+class NpySpan
+{
+public:
+    NpySpan(const char *bytes, size_t n) : bytes(bytes), n(n) { }
+
+    size_t size() const { return n; }
+
+    T operator[](size_t i) const
+    {
+        T v;
+        memcpy(&v, bytes + i * sizeof(T), sizeof(T));
+        return v;
+    }
+
+    bool aligned() const { return (uintptr_t)bytes % sizeof(T) == 0; }
+
+    const T *data() const
+    {
+        if (!aligned())
+            throw std::runtime_error("npy: payload is not aligned for direct access");
+        return (const T *)bytes;
+    }
+
+protected:
+    const char *bytes;
+    size_t n;
+};
+
+template <typename T> struct NpyDtype;
+template <> struct NpyDtype<float>   { static const char kind = 'f'; };
+template <> struct NpyDtype<double>  { static const char kind = 'f'; };
+template <> struct NpyDtype<int8_t>  { static const char kind = 'i'; };
+template <> struct NpyDtype<int32_t> { static const char kind = 'i'; };
+template <> struct NpyDtype<int64_t> { static const char kind = 'i'; };
+template <> struct NpyDtype<uint8_t> { static const char kind = 'u'; };
+
+struct NpyArray
+{
+    std::vector<size_t> shape;
+    char kind;          // 'f', 'i', 'u' or 'b' as in the numpy descr
+    size_t word_size;   // bytes per element
+    bool fortran_order;
+    const char *data;   // payload, owned by the NpzFile it came from
+    size_t bytes;
+
+    size_t size() const;
+
+    // zero-copy view, throws unless the dtype is exactly T and the
+    // array is laid out in C order
+    template <typename T>
+    NpySpan<T> span() const
+    {
+        if (kind != NpyDtype<T>::kind || word_size != sizeof(T))
+            throw std::runtime_error("npy: dtype does not match the requested span");
+        if (fortran_order && shape.size() > 1)
+            throw std::runtime_error("npy: fortran ordered array cannot be viewed in C order");
+        return NpySpan<T>(data, size());
+    }
+
+    // copy the elements out converted to float/double, in C order
+    std::vector<float> as_float() const;
+    std::vector<double> as_double() const;
+};
+
+// validate the header of a single .npy blob and point into its payload
+NpyArray npy_parse(const char *buf, size_t len);
+
+// a memory mapped .npz archive, members keyed by name without ".npy"
+class NpzFile
+{
+public:
+    explicit NpzFile(const std::string &filename);
+    ~NpzFile();
+
+    bool has(const std::string &name) const;
+
+    // throws std::runtime_error naming the file when name is missing
+    const NpyArray &operator[](const std::string &name) const;
+
+    const std::map<std::string, NpyArray> &arrays() const { return members; }
+
+protected:
+    std::string filename;
+    char *mapping;
+    size_t length;
+    std::map<std::string, NpyArray> members;
+    std::vector<std::vector<char> > inflated;
+
+private:
+    NpzFile(const NpzFile &);
+    NpzFile &operator=(const NpzFile &);
+};
+
+// writes an uncompressed .npz that np.load reads. Members are streamed:
+// begin() with the final shape, write() the payload in C order in as
+// many pieces as convenient, end() once all of it is out.
+class NpzWriter
+{
+public:
+    explicit NpzWriter(const std::string &filename);
+    ~NpzWriter();
+
+    void begin(const std::string &name, char kind, size_t word_size,
+               const std::vector<size_t> &shape);
+    void write(const void *data, size_t bytes);
+    void end();
+
+    // writes the central directory, the archive is unusable before
+    void close();
+
+    template <typename T>
+    void save(const std::string &name, const T *data, const std::vector<size_t> &shape)
+    {
+        size_t n = 1;
+        for (size_t i = 0; i < shape.size(); i++)
+            n *= shape[i];
+        begin(name, NpyDtype<T>::kind, sizeof(T), shape);
+        write(data, n * sizeof(T));
+        end();
+    }
+
+protected:
+    struct Entry
+    {
+        std::string name;
+        uint32_t crc;
+        unsigned long long size;
+        unsigned long long offset;
+    };
+
+    std::string filename;
+    FILE *f;
+    std::vector<Entry> entries;
+    bool in_member;
+    unsigned long long expected;
+};
+
+#endif
@@ -0,0 +1,612 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Native port of the LSTM in rnn_LSTM_CPU.py, see rnn_LSTM_CPU.h.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "npz.h"
+#include "rnn_LSTM_CPU.h"
+#include "spectrum.h"
+#include "weight_blob.h"
+
+using namespace std;
+
+static double hard_sigmoid(double x)
+{
+    double slope = 0.2;
+    double shift = 0.5;
+    x = (x * slope) + shift;
+    if (x < 0.0)
+        return 0.0;
+    if (x > 1.0)
+        return 1.0;
+    return x;
+}
+
+//finding soft max
+static void softmax(double *x, int n)
+{
+    double m = x[0];
+    for (int k = 1; k < n; k++)
+        if (x[k] > m)
+            m = x[k];
+
+    double sum = 0.0;
+    for (int k = 0; k < n; k++)
+    {
+        x[k] = exp(x[k] - m);
+        sum += x[k];
+    }
+    for (int k = 0; k < n; k++)
+        x[k] /= sum;
+}
+
+// y = M.dot(v) for a (rows, cols) row major M
+static void dot(const float *M, const double *v, int rows, int cols, double *y)
+{
+    for (int r = 0; r < rows; r++)
+    {
+        const float *m = M + (size_t)r * cols;
+        double acc = 0.0;
+        for (int k = 0; k < cols; k++)
+            acc += m[k] * v[k];
+        y[r] = acc;
+    }
+}
+
+RNN::RNN(int input_dim, int hidden_dim, int output_dim) :
+    input_dim(input_dim), hidden_dim(hidden_dim), output_dim(output_dim)
+{
+    packed.hidden = packed.padded = 0;
+    threads = 0;
+    projection = PROJECT_DENSE;
+    sparse_threshold = 0.0f;
+    sparse_top_k = 0;
+    columns.rows = columns.cols = columns.ld = 0;
+    quantized.rows = quantized.cols = quantized.ld = 0;
+}
+
+void RNN::load_param(const string &filename)
+{
+    if (weight_blob_check(filename))
+    {
+        weight_blob_load(filename, *this);
+        return;
+    }
+
+    NpzFile npz(filename);
+    const NpyArray &a = npz["A"];
+    const NpyArray &u = npz["U"];
+    const NpyArray &v = npz["V"];
+    const NpyArray &w = npz["W"];
+    const NpyArray &bb = npz["b"];
+    const NpyArray &c = npz["c_o"];
+
+    if (a.shape.size() != 2 || v.shape.size() != 2)
+        throw runtime_error(filename + ": A and V must be 2-d");
+    int H = (int)a.shape[0];
+    int I = (int)a.shape[1];
+    int O = (int)v.shape[0];
+
+    if (u.size() != (size_t)4 * H * H || w.size() != (size_t)4 * H * H ||
+        v.shape[1] != (size_t)H || bb.size() != (size_t)4 * H || c.size() != (size_t)O)
+        throw runtime_error(filename + ": inconsistent parameter shapes");
+
+    input_dim = I;
+    hidden_dim = H;
+    output_dim = O;
+    vector<float> a_f = a.as_float();
+    A = SharedWeights<float>(AlignedFloats(a_f.begin(), a_f.end()));
+    U = u.as_float();
+    V = v.as_float();
+    W = w.as_float();
+    b = bb.as_float();
+    c_o = c.as_float();
+    pack();
+    set_projection(projection);
+}
+
+void RNN::save_param(const string &filename) const
+{
+    if (A.empty())
+        throw runtime_error("RNN: cannot save a model without the float A");
+
+    // float64 like the original Theano export
+    size_t I = input_dim, H = hidden_dim, O = output_dim;
+    NpzWriter npz(filename);
+    vector<double> a(A.data(), A.data() + A.size());
+    npz.save("A", &a[0], {H, I});
+    a.assign(U.begin(), U.end());
+    npz.save("U", &a[0], {4, H, H});
+    a.assign(V.begin(), V.end());
+    npz.save("V", &a[0], {O, H});
+    a.assign(W.begin(), W.end());
+    npz.save("W", &a[0], {4, H, H});
+    a.assign(b.begin(), b.end());
+    npz.save("b", &a[0], {4, H});
+    a.assign(c_o.begin(), c_o.end());
+    npz.save("c_o", &a[0], {O});
+    npz.close();
+}
+
+void RNN::pack()
+{
+    lstm_pack(&U[0], &W[0], &b[0], hidden_dim, packed);
+}
+
+void RNN::set_projection(Projection mode)
+{
+    if (A.empty() && !quantized.w.empty() && mode != PROJECT_INT8)
+        throw runtime_error("RNN: the int8 weight blob has no float A for this projection");
+
+    projection = mode;
+    if (mode == PROJECT_SPARSE && !A.empty())
+        lstm_pack_columns(A.data(), hidden_dim, input_dim, columns);
+    else
+        columns.w = SharedWeights<float>();
+
+    if (mode == PROJECT_INT8 && !A.empty())
+        lstm_quantize_rows(A.data(), hidden_dim, input_dim, quantized);
+    else if (mode != PROJECT_INT8)
+    {
+        quantized.w = SharedWeights<signed char>();
+        quantized.scale = SharedWeights<float>();
+    }
+}
+
+void RNN::project_inputs(const float *x, int T, float *x_e) const
+{
+    int P = packed.padded;
+    if (projection == PROJECT_SPARSE)
+    {
+        vector<int> idx(input_dim);
+        for (int t = 0; t < T; t++)
+        {
+            const float *xt = x + (size_t)t * input_dim;
+            int n = lstm_active_bins(xt, input_dim, sparse_threshold, sparse_top_k, &idx[0]);
+            lstm_project_sparse(columns, xt, &idx[0], n, x_e + (size_t)t * P);
+        }
+        return;
+    }
+    if (projection == PROJECT_INT8)
+    {
+        lstm_project_int8(quantized, x, T, x_e, P, threads);
+        return;
+    }
+
+    // the input projection does not depend on the recurrent state, so it
+    // is done for the whole song up front as one GEMM
+    lstm_project(A.data(), x, T, hidden_dim, input_dim, x_e, P, threads);
+}
+
+// softmax(V.dot(s) + c_o) with the shape fixed at compile time, so the
+// logits live on the stack and every loop has a constant trip count.
+// Four rows run side by side: each sum keeps the order of the generic
+// loop, but the four dependency chains overlap instead of one waiting
+// on the latency of the previous add.
+template <int H, int O>
+static void output_fixed(const float *V, const float *c_o, const float *s, float *out)
+{
+    static_assert(O % 4 == 0, "output_fixed() works on groups of four rows");
+    double o[O];
+    for (int k = 0; k < O; k += 4)
+    {
+        const float *v0 = V + (size_t)k * H;
+        const float *v1 = v0 + H, *v2 = v1 + H, *v3 = v2 + H;
+        double a0 = c_o[k], a1 = c_o[k + 1], a2 = c_o[k + 2], a3 = c_o[k + 3];
+        for (int j = 0; j < H; j++)
+        {
+            a0 += v0[j] * s[j];
+            a1 += v1[j] * s[j];
+            a2 += v2[j] * s[j];
+            a3 += v3[j] * s[j];
+        }
+        o[k] = a0;
+        o[k + 1] = a1;
+        o[k + 2] = a2;
+        o[k + 3] = a3;
+    }
+    softmax(o, O);
+    for (int k = 0; k < O; k++)
+        out[k] = (float)o[k];
+}
+
+void RNN::output_layer(const float *s, float *out) const
+{
+    int H = hidden_dim;
+    int O = output_dim;
+    if (H == LSTM_HIDDEN_OCTAVE && O == LSTM_OUTPUT_OCTAVE)
+    {
+        output_fixed<LSTM_HIDDEN_OCTAVE, LSTM_OUTPUT_OCTAVE>(&V[0], &c_o[0], s, out);
+        return;
+    }
+    if (H == LSTM_HIDDEN_KEYBOARD && O == LSTM_OUTPUT_KEYBOARD)
+    {
+        output_fixed<LSTM_HIDDEN_KEYBOARD, LSTM_OUTPUT_KEYBOARD>(&V[0], &c_o[0], s, out);
+        return;
+    }
+
+    vector<double> o(O);
+    for (int k = 0; k < O; k++)
+    {
+        const float *v = &V[(size_t)k * H];
+        double acc = c_o[k];
+        for (int j = 0; j < H; j++)
+            acc += v[j] * s[j];
+        o[k] = acc;
+    }
+    softmax(&o[0], O);
+    for (int k = 0; k < O; k++)
+        out[k] = (float)o[k];
+}
+
+bool RNN::specialized() const
+{
+    return lstm_step_specialized(hidden_dim) &&
+           ((hidden_dim == LSTM_HIDDEN_OCTAVE && output_dim == LSTM_OUTPUT_OCTAVE) ||
+            (hidden_dim == LSTM_HIDDEN_KEYBOARD && output_dim == LSTM_OUTPUT_KEYBOARD));
+}
+
+void RNN::forward_prop(const float *x, int T, vector<float> &out, vector<float> &s) const
+{
+    int H = hidden_dim;
+    int O = output_dim;
+    out.assign((size_t)T * O, 0.0f);
+    s.assign((size_t)T * H, 0.0f);
+
+    int P = packed.padded;
+    AlignedFloats x_e((size_t)T * P, 0.0f);
+    project_inputs(x, T, &x_e[0]);
+
+    AlignedFloats s_prev(P, 0.0f), s_cur(P, 0.0f), c(P, 0.0f);
+    for (int t = 0; t < T; t++)
+    {
+        lstm_step(packed, &x_e[(size_t)t * P], &s_prev[0], &s_cur[0], &c[0]);
+        copy(s_cur.begin(), s_cur.begin() + H, s.begin() + (size_t)t * H);
+        output_layer(&s_cur[0], &out[(size_t)t * O]);
+        s_prev.swap(s_cur);
+    }
+}
+
+void RNN::forward_prop_reference(const float *x, int T, vector<float> &out, vector<float> &s) const
+{
+    if (A.empty())
+        throw runtime_error("RNN: the reference path needs the float A");
+
+    int H = hidden_dim;
+    int O = output_dim;
+    out.assign((size_t)T * O, 0.0f);
+    s.assign((size_t)T * H, 0.0f);
+
+    vector<double> x_t(input_dim), x_e(H), s_prev(H, 0.0), c(H, 0.0);
+    vector<double> ux(H), ws(H), gate(4 * H), o(O);
+
+    for (int t = 0; t < T; t++)
+    {
+        const float *xt = x + (size_t)t * input_dim;
+        for (int k = 0; k < input_dim; k++)
+            x_t[k] = xt[k];
+        dot(A.data(), &x_t[0], H, input_dim, &x_e[0]);
+
+        for (int g = 0; g < 4; g++)
+        {
+            dot(&U[(size_t)g * H * H], &x_e[0], H, H, &ux[0]);
+            dot(&W[(size_t)g * H * H], &s_prev[0], H, H, &ws[0]);
+            // the g gate reuses b[2] exactly like forward_prop() does
+            const float *bias = &b[(size_t)(g == 3 ? 2 : g) * H];
+            for (int k = 0; k < H; k++)
+                gate[g * H + k] = ux[k] + ws[k] + bias[k];
+        }
+
+        for (int k = 0; k < H; k++)
+        {
+            double i = hard_sigmoid(gate[k]);
+            double f = hard_sigmoid(gate[H + k]);
+            double og = hard_sigmoid(gate[2 * H + k]);
+            double g = tanh(gate[3 * H + k]);
+            c[k] = c[k] * f + g * i;
+            s_prev[k] = tanh(c[k]) * og;
+            s[(size_t)t * H + k] = (float)s_prev[k];
+        }
+
+        dot(&V[0], &s_prev[0], O, H, &o[0]);
+        for (int k = 0; k < O; k++)
+            o[k] += c_o[k];
+        softmax(&o[0], O);
+        for (int k = 0; k < O; k++)
+            out[(size_t)t * O + k] = (float)o[k];
+    }
+}
+
+vector<int> RNN::predict(const float *x, int T) const
+{
+    return predict_with_confidence(x, T).notes;
+}
+
+// argmax and top-2 margin of every frame of p.probabilities
+static void summarize(Prediction &p, int T, int O)
+{
+    p.notes.resize(T);
+    p.margin.resize(T);
+    for (int t = 0; t < T; t++)
+    {
+        const float *o = &p.probabilities[(size_t)t * O];
+        int best = 0;
+        for (int k = 1; k < O; k++)
+            if (o[k] > o[best])
+                best = k;
+        float second = 0.0f;
+        for (int k = 0; k < O; k++)
+            if (k != best && o[k] > second)
+                second = o[k];
+        p.notes[t] = best;
+        p.margin[t] = o[best] - second;
+    }
+}
+
+Prediction RNN::predict_with_confidence(const float *x, int T) const
+{
+    Prediction p;
+    vector<float> s;
+    forward_prop(x, T, p.probabilities, s);
+    summarize(p, T, output_dim);
+    return p;
+}
+
+void RNN::check_input(const vector<float> &X, int T) const
+{
+    if (T < 0 || X.size() != (size_t)T * input_dim)
+    {
+        char msg[160];
+        snprintf(msg, sizeof(msg), "RNN: input has %zu values, not %d frames of %d bins",
+                 X.size(), T, input_dim);
+        throw runtime_error(msg);
+    }
+}
+
+void RNN::forward_prop(const vector<float> &X, int T, vector<float> &out, vector<float> &s) const
+{
+    check_input(X, T);
+    forward_prop(X.data(), T, out, s);
+}
+
+vector<int> RNN::predict(const vector<float> &X, int T) const
+{
+    check_input(X, T);
+    return predict(X.data(), T);
+}
+
+Prediction RNN::predict_with_confidence(const vector<float> &X, int T) const
+{
+    check_input(X, T);
+    return predict_with_confidence(X.data(), T);
+}
+
+void RNN::forward_batch(const vector<const float *> &x, const vector<int> &T,
+                        vector<vector<float> > &out) const
+{
+    if (x.size() != T.size())
+        throw runtime_error("RNN: forward_batch() needs one length per song");
+
+    int N = (int)x.size();
+    int O = output_dim;
+    int P = packed.padded;
+    out.resize(N);
+
+    // longest songs first, so the songs still running at step t are
+    // always a prefix of this order
+    vector<int> order(N);
+    for (int n = 0; n < N; n++)
+        order[n] = n;
+    stable_sort(order.begin(), order.end(), [&](int a, int b) { return T[a] > T[b]; });
+
+    vector<AlignedFloats> x_e(N);
+    for (int n = 0; n < N; n++)
+    {
+        out[n].assign((size_t)max(T[n], 0) * O, 0.0f);
+        if (T[n] <= 0)
+            continue;
+        x_e[n].assign((size_t)T[n] * P, 0.0f);
+        project_inputs(x[n], T[n], &x_e[n][0]);
+    }
+
+    AlignedFloats s_prev((size_t)N * P, 0.0f), s_cur((size_t)N * P, 0.0f), c((size_t)N * P, 0.0f);
+    vector<const float *> xp(N), sp(N);
+    vector<float *> sc(N), cp(N);
+    int active = N;
+    for (int t = 0; active > 0; t++)
+    {
+        while (active > 0 && T[order[active - 1]] <= t)
+            active--;
+        for (int i = 0; i < active; i++)
+        {
+            int n = order[i];
+            xp[i] = &x_e[n][(size_t)t * P];
+            sp[i] = &s_prev[(size_t)n * P];
+            sc[i] = &s_cur[(size_t)n * P];
+            cp[i] = &c[(size_t)n * P];
+        }
+        lstm_step_batch(packed, active, &xp[0], &sp[0], &sc[0], &cp[0]);
+        for (int i = 0; i < active; i++)
+            output_layer(sc[i], &out[order[i]][(size_t)t * O]);
+        s_prev.swap(s_cur);
+    }
+}
+
+vector<Prediction> RNN::predict_batch(const vector<const float *> &x, const vector<int> &T) const
+{
+    vector<vector<float> > out;
+    forward_batch(x, T, out);
+
+    vector<Prediction> p(x.size());
+    for (size_t n = 0; n < x.size(); n++)
+    {
+        p[n].probabilities.swap(out[n]);
+        summarize(p[n], max(T[n], 0), output_dim);
+    }
+    return p;
+}
+
+RNNStream::RNNStream(const RNN &model) :
+    model(model)
+{
+    reset();
+}
+
+void RNNStream::reset()
+{
+    int P = model.packed.padded;
+    x_e.assign(P, 0.0f);
+    s_prev.assign(P, 0.0f);
+    s_cur.assign(P, 0.0f);
+    c.assign(P, 0.0f);
+    out.assign(model.output_dim, 0.0f);
+    t = 0;
+}
+
+int RNNStream::push(const float *frame)
+{
+    model.project_inputs(frame, 1, &x_e[0]);
+    lstm_step(model.packed, &x_e[0], &s_prev[0], &s_cur[0], &c[0]);
+    model.output_layer(&s_cur[0], &out[0]);
+    s_prev.swap(s_cur);
+    t++;
+
+    int best = 0;
+    for (int k = 1; k < model.output_dim; k++)
+        if (out[k] > out[best])
+            best = k;
+    return best;
+}
+
+RNNState RNNStream::snapshot() const
+{
+    RNNState state;
+    state.s.assign(s_prev.begin(), s_prev.begin() + model.hidden_dim);
+    state.c.assign(c.begin(), c.begin() + model.hidden_dim);
+    state.frames = t;
+    return state;
+}
+
+void RNNStream::restore(const RNNState &state)
+{
+    if ((int)state.s.size() != model.hidden_dim || (int)state.c.size() != model.hidden_dim)
+        throw runtime_error("RNNStream: state does not match the model");
+    reset();
+    copy(state.s.begin(), state.s.end(), s_prev.begin());
+    copy(state.c.begin(), state.c.end(), c.begin());
+    t = state.frames;
+}
+
+// the float32 frames the engine runs on. C ordered float32 and float64
+// payloads, what np.save writes for the recordings, are read through a
+// typed view of the mapping; anything else goes through as_float()
+static vector<float> frames_of(const NpyArray &a)
+{
+    if (a.fortran_order && a.shape.size() > 1)
+        return a.as_float();
+
+    vector<float> x;
+    if (a.kind == 'f' && a.word_size == sizeof(float))
+    {
+        NpySpan<float> v = a.span<float>();
+        if (v.aligned())
+            return vector<float>(v.data(), v.data() + v.size());
+        x.resize(v.size());
+        for (size_t i = 0; i < x.size(); i++)
+            x[i] = v[i];
+        return x;
+    }
+    if (a.kind == 'f' && a.word_size == sizeof(double))
+    {
+        NpySpan<double> v = a.span<double>();
+        x.resize(v.size());
+        for (size_t i = 0; i < x.size(); i++)
+            x[i] = (float)v[i];
+        return x;
+    }
+    return a.as_float();
+}
+
+//Getting from all data
+int get_data(const string &filename, vector<float> &X, vector<float> &Y)
+{
+    // raw recordings go through the spectral front-end, no labels there
+    if (filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".wav") == 0)
+    {
+        Y.clear();
+        return wav_spectrum(filename, X);
+    }
+
+    // converted straight out of the mapped file, the float64 payload is
+    // never copied on its own
+    NpzFile npz(filename);
+    const NpyArray &data = npz["data"];
+    if (data.shape.size() != 2)
+        throw runtime_error(filename + ": data must be 2-d (frames, bins)");
+    int T = (int)data.shape[0];
+    X = frames_of(data);
+    if (npz.has("out"))
+    {
+        const NpyArray &out = npz["out"];
+        if (out.shape.size() != 2 || out.shape[0] != data.shape[0])
+            throw runtime_error(filename + ": out must be 2-d with a row per frame of data");
+        Y = frames_of(out);
+    }
+    else
+        Y.clear();
+    return T;
+}
+
+static bool has_suffix(const string &s, const string &suffix)
+{
+    return s.size() > suffix.size() &&
+           s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static bool is_song_npz(const string &filename)
+{
+    try
+    {
+        NpzFile npz(filename);
+        return npz.has("data");
+    }
+    catch (const exception &)
+    {
+        return true;
+    }
+}
+
+void collect_songs(const string &path, vector<string> &songs, bool wav)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        throw runtime_error("cannot access " + path);
+    if (!S_ISDIR(st.st_mode))
+    {
+        songs.push_back(path);
+        return;
+    }
+
+    DIR *dir = opendir(path.c_str());
+    if (!dir)
+        throw runtime_error("cannot open directory " + path);
+    vector<string> found;
+    while (struct dirent *e = readdir(dir))
+    {
+        string name = e->d_name;
+        string file = path + "/" + name;
+        if ((has_suffix(name, ".npz") && is_song_npz(file)) ||
+            (wav && has_suffix(name, ".wav")))
+            found.push_back(file);
+    }
+    closedir(dir);
+    sort(found.begin(), found.end());
+    songs.insert(songs.end(), found.begin(), found.end());
+}
@@ -0,0 +1,188 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Native port of the LSTM in rnn_LSTM_CPU.py, so the controller can
+// transcribe a song without booting a Python interpreter.
+//
+// The forward pass mirrors RNN.forward_prop() step by step, including
+// hard_sigmoid gates, tanh and the softmax output layer.
+
+#ifndef RNN_LSTM_CPU_H
+#define RNN_LSTM_CPU_H
+
+#include <string>
+#include <vector>
+
+#include "lstm_kernels.h"
+
+#define INPUT_DIM           20000
+#define RNN_PARAM_FILE      "rnn-theano-parameters-one-octave-songs-2.npz"
+#define RNN_DEFAULT_SONG    "dirty_example_B4.npz"
+
+// how the 20000-bin input projection A.dot(x) is computed
+enum Projection
+{
+    PROJECT_DENSE,      // all bins, batched over the song
+    PROJECT_SPARSE,     // only the active bins of every frame
+    PROJECT_INT8        // int8 copy of A, int32 dot products
+};
+
+// everything one forward pass yields, so callers never run it twice
+struct Prediction
+{
+    std::vector<int> notes;             // argmax per frame
+    std::vector<float> probabilities;   // (T, output_dim) softmax output
+    std::vector<float> margin;          // top-1 minus top-2 probability
+};
+
+class RNN
+{
+public:
+    //INPUT: 20,000 sized input array (0.1hz step size)
+    //OUTPUT: 12 sized output array for each half note in an octave
+    // (the defaults; load_param() takes the real shapes from the file)
+    RNN(int input_dim=INPUT_DIM, int hidden_dim=100, int output_dim=12);
+
+    // load A, U, V, W, b, c_o from an npz written by RNN.save_param(),
+    // or map a weight blob written by rnn_blob (see weight_blob.h);
+    // the dimensions are taken from the file
+    void load_param(const std::string &filename);
+
+    // write A, U, V, W, b, c_o as float64 in the same npz schema
+    void save_param(const std::string &filename) const;
+
+    // rebuild the packed recurrent weights after U, W or b were changed
+    void pack();
+
+    // select the input projection, building the copy of A it needs;
+    // a model loaded from an int8 weight blob only has PROJECT_INT8
+    void set_projection(Projection mode);
+
+    // x is (T, input_dim) row major; out is filled with the (T, output_dim)
+    // softmax outputs and s with the (T, hidden_dim) hidden states
+    void forward_prop(const float *x, int T,
+                      std::vector<float> &out, std::vector<float> &s) const;
+
+    // straight double precision port of forward_prop(), one gate at a time,
+    // kept to check the optimized kernels against
+    void forward_prop_reference(const float *x, int T,
+                                std::vector<float> &out, std::vector<float> &s) const;
+
+    // argmax of the softmax output for every frame
+    std::vector<int> predict(const float *x, int T) const;
+
+    // notes, softmax output and top-2 margin from a single forward pass
+    Prediction predict_with_confidence(const float *x, int T) const;
+
+    // throws std::runtime_error unless X holds T frames of input_dim bins
+    void check_input(const std::vector<float> &X, int T) const;
+
+    // the same on frames read by get_data(), rejecting any X that does
+    // not match the model through check_input()
+    void forward_prop(const std::vector<float> &X, int T,
+                      std::vector<float> &out, std::vector<float> &s) const;
+    std::vector<int> predict(const std::vector<float> &X, int T) const;
+    Prediction predict_with_confidence(const std::vector<float> &X, int T) const;
+
+    // forward_prop() of N independent songs stepped together: x[n] is
+    // (T[n], input_dim) and out[n] gets its (T[n], output_dim) softmax
+    // output. Songs that have ended drop out of the remaining steps.
+    void forward_batch(const std::vector<const float *> &x, const std::vector<int> &T,
+                       std::vector<std::vector<float> > &out) const;
+
+    // predict_with_confidence() for every song of a batch
+    std::vector<Prediction> predict_batch(const std::vector<const float *> &x,
+                                          const std::vector<int> &T) const;
+
+    // whether (hidden_dim, output_dim) runs on the compile-time specialized
+    // kernels (see lstm_kernels.h) rather than the generic ones
+    bool specialized() const;
+
+    int input_dim;
+    int hidden_dim;
+    int output_dim;
+
+    SharedWeights<float> A; // (hidden, input), empty for an int8 weight blob
+    std::vector<float> U;   // (4, hidden, hidden) [i, f, o, g]
+    std::vector<float> V;   // (output, hidden)
+    std::vector<float> W;   // (4, hidden, hidden) [i, f, o, g]
+    std::vector<float> b;   // (4, hidden)
+    std::vector<float> c_o; // (output)
+
+    LSTMPacked packed;      // U, W and b in the fused kernel layout
+
+    int threads;            // threads for the input projection, 0 = all cores
+
+    Projection projection;
+    float sparse_threshold; // PROJECT_SPARSE skips bins with |x| below this
+    int sparse_top_k;       // and keeps at most this many per frame, 0 = all
+    LSTMColumns columns;    // column major A for PROJECT_SPARSE
+    LSTMInt8 quantized;     // int8 A for PROJECT_INT8
+
+    // the stages of forward_prop(), for RNNStream and rnn_bench
+
+    // x_e (T, packed.padded) = A.dot(x[t]) for every frame
+    void project_inputs(const float *x, int T, float *x_e) const;
+
+    // softmax(V.dot(s) + c_o) for one frame
+    void output_layer(const float *s, float *out) const;
+};
+
+// recurrent state (hidden s and cell c) of a stream between two frames
+struct RNNState
+{
+    std::vector<float> s;
+    std::vector<float> c;
+    int frames;
+};
+
+// frame by frame inference: holds the (s, c) state of one song so every
+// spectral frame can be classified as soon as it arrives, instead of
+// waiting for the whole recording like forward_prop() does
+class RNNStream
+{
+public:
+    // the model must outlive the stream and stay unchanged while in use
+    RNNStream(const RNN &model);
+
+    // feed one frame of model.input_dim bins, returns the predicted note;
+    // the softmax output is then available from probabilities()
+    int push(const float *frame);
+
+    const std::vector<float> &probabilities() const { return out; }
+
+    // number of frames pushed since the last reset
+    int frames() const { return t; }
+
+    // back to the zero state of a new song
+    void reset();
+
+    RNNState snapshot() const;
+    void restore(const RNNState &state);
+
+protected:
+    const RNN &model;
+    AlignedFloats x_e;
+    AlignedFloats s_prev;
+    AlignedFloats s_cur;
+    AlignedFloats c;
+    std::vector<float> out;
+    int t;
+};
+
+// read the "data" and "out" arrays of a dirty_example_*.npz file, or
+// compute the data frames of a .wav recording (Y left empty);
+// returns the number of frames T. Both arrays must be 2-d with T rows,
+// std::runtime_error otherwise
+int get_data(const std::string &filename,
+             std::vector<float> &X, std::vector<float> &Y);
+
+// append the songs under path to songs: path itself when it is a file,
+// otherwise the files of the directory (not recursively), sorted. Of
+// those an .npz is a song when it holds "data", so goldens and parameter
+// files are left out, and a .wav only when wav is set. One that cannot
+// be opened is kept for get_data() to report. std::runtime_error when
+// path cannot be read
+void collect_songs(const std::string &path, std::vector<std::string> &songs,
+                   bool wav);
+
+#endif
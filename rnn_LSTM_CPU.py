@@ -62,15 +62,17 @@ class RNN:
         o, s = self.forward_prop(x)
         return np.argmax(o, axis=1)
 
+    #notes, softmax output and top-2 margin from a single forward pass
+    def predict_with_confidence(self, x):
+        o, s = self.forward_prop(x)
+        notes = np.argmax(o, axis=1)
+        top2 = np.sort(o, axis=1)[:, -2:]
+        return notes, o, top2[:, 1] - top2[:, 0]
+
     #Save parameters U, V, W
+    #plain numpy arrays now (no Theano shared variables), same schema as rnn_train writes
     def save_param(self, filename):
-        A = self.A.get_value()
-        U = self.U.get_value()
-        V = self.V.get_value()
-        W = self.W.get_value()
-        b = self.b.get_value()
-        c_o = self.c_o.get_value()
-        np.savez(filename, A=A, U=U, V=V, W=W, b=b, c_o=c_o)
+        np.savez(filename, A=self.A, U=self.U, V=self.V, W=self.W, b=self.b, c_o=self.c_o)
 
     #Load parameters back in
     def load_param(self, filename):
@@ -85,20 +87,17 @@ def get_data(filename):
     return X, Y
 
 def predict_connection():
-    force_list = []
     np.random.seed(10)
     model = RNN()
 
     if load_save:
         model.load_param("rnn-theano-parameters-one-octave-songs-2.npz")
     X, Y = get_data("dirty_example_B4.npz")
-    o, s = model.forward_prop(np.float32(X))
-    temp = model.predict(np.float32(X))
+    temp, o, margin = model.predict_with_confidence(np.float32(X))
     # print o
     # print temp
-    for i in range(len(temp)):
-        force_list.append(temp[i])
-    return force_list
+    # hand the arrays over as they are, call_python reads their buffers
+    return temp, o
 
 # np.random.seed(10)
 # model = RNN()
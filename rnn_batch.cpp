@@ -0,0 +1,294 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Transcribes a whole set of songs before a session. The model is loaded
+// once and shared read-only by a pool of worker threads, each of which
+// takes the next file, runs the LSTM on it single threaded and writes
+// <out>/<name>.notes in the note_stream.h format: one record per note
+// event from the Viterbi decoder (note, mean confidence, onset and
+// duration in frames). When a.npz and a.wav are both given they are
+// written to a.npz.notes and a.wav.notes. summary.txt in the same
+// directory lists the per-file latency.
+//
+// usage: rnn_batch [--param file.npz] [--jobs n] [--batch n] [--out dir]
+//                  [--switch-penalty nats] dir|song ...
+//
+// Directories are searched (not recursively) for .wav files and the .npz
+// songs, those with a "data" array; goldens and parameter files are not.
+// With --batch n every worker takes n songs at a time and steps them
+// together through RNN::predict_batch(); infer_ms is then the time of
+// the whole batch.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "note_decoder.h"
+#include "note_stream.h"
+#include "rnn_LSTM_CPU.h"
+
+using namespace std;
+
+struct BatchResult
+{
+    string output;
+    int frames;
+    int events;
+    double load_ms;
+    double infer_ms;
+    string error;
+};
+
+static double elapsed_ms(chrono::steady_clock::time_point since)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - since).count();
+}
+
+static string base_name(const string &song)
+{
+    size_t slash = song.find_last_of('/');
+    return (slash == string::npos) ? song : song.substr(slash + 1);
+}
+
+static string stem(const string &base)
+{
+    return base.substr(0, base.find_last_of('.'));
+}
+
+// <out>/<name>.notes for every song. Songs whose names only differ in
+// the extension keep it (a.npz.notes, a.wav.notes); any clash left, the
+// same file name in two directories, is an error for the later song.
+static void output_names(const string &out_dir, const vector<string> &songs,
+                         vector<BatchResult> &results)
+{
+    map<string, int> stems;
+    for (size_t n = 0; n < songs.size(); n++)
+        stems[stem(base_name(songs[n]))]++;
+
+    map<string, size_t> taken;
+    for (size_t n = 0; n < songs.size(); n++)
+    {
+        string base = base_name(songs[n]);
+        string name = (stems[stem(base)] > 1) ? base : stem(base);
+        BatchResult &r = results[n];
+        r.output = out_dir + "/" + name + ".notes";
+        if (taken.count(r.output))
+            r.error = r.output + " is already written for " + songs[taken[r.output]];
+        else
+            taken[r.output] = n;
+    }
+}
+
+// the whole batch songs[first, first + n) through one predict_batch()
+static void transcribe(const RNN &model, const vector<string> &songs, size_t first, size_t n,
+                       double switch_penalty, vector<BatchResult> &results)
+{
+    vector<vector<float> > X(n);
+    vector<const float *> x;
+    vector<int> T;
+    vector<size_t> index;
+    for (size_t i = 0; i < n; i++)
+    {
+        BatchResult &r = results[first + i];
+        r.frames = r.events = 0;
+        r.load_ms = r.infer_ms = 0.0;
+        if (!r.error.empty())
+            continue;
+        try
+        {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            vector<float> Y;
+            int frames = get_data(songs[first + i], X[i], Y);
+            model.check_input(X[i], frames);
+            T.push_back(frames);
+            x.push_back(X[i].data());
+            index.push_back(first + i);
+            r.load_ms = elapsed_ms(start);
+        }
+        catch (const exception &e)
+        {
+            r.error = e.what();
+        }
+    }
+
+    // a failure here (e.g. bad_alloc on a very long song) belongs to
+    // every song of the group, the other groups go on
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<Prediction> p;
+    try
+    {
+        if (x.size() == 1)
+            p.push_back(model.predict_with_confidence(x[0], T[0]));
+        else if (!x.empty())
+            p = model.predict_batch(x, T);
+    }
+    catch (const exception &e)
+    {
+        for (size_t i = 0; i < x.size(); i++)
+            results[index[i]].error = e.what();
+        return;
+    }
+    double infer_ms = elapsed_ms(start);
+
+    for (size_t i = 0; i < x.size(); i++)
+    {
+        BatchResult &r = results[index[i]];
+        try
+        {
+            start = chrono::steady_clock::now();
+            vector<NoteEvent> events = decode_notes(p[i].probabilities.data(), T[i],
+                                                    model.output_dim, switch_penalty);
+            r.infer_ms = infer_ms + elapsed_ms(start);
+            r.frames = T[i];
+            r.events = (int)events.size();
+
+            vector<NoteRecord> records(events.size());
+            for (size_t e = 0; e < events.size(); e++)
+            {
+                records[e].note = events[e].note;
+                records[e].confidence = events[e].confidence;
+                records[e].onset = events[e].onset;
+                records[e].duration = events[e].duration;
+            }
+
+            FILE *f = fopen(r.output.c_str(), "wb");
+            if (!f)
+                throw runtime_error("cannot create " + r.output);
+            bool ok = note_stream_write(f, records, NOTE_STREAM_CONFIDENCE | NOTE_STREAM_TIMING);
+            ok = (fclose(f) == 0) && ok;
+            if (!ok)
+                throw runtime_error("cannot write " + r.output);
+        }
+        catch (const exception &e)
+        {
+            r.error = e.what();
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    string param = RNN_PARAM_FILE;
+    string out_dir = ".";
+    int jobs = (int)thread::hardware_concurrency();
+    int batch = 1;
+    double switch_penalty = DECODER_SWITCH_PENALTY;
+    vector<string> inputs;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--param" && i + 1 < argc)
+            param = argv[++i];
+        else if (arg == "--jobs" && i + 1 < argc)
+            jobs = atoi(argv[++i]);
+        else if (arg == "--batch" && i + 1 < argc)
+            batch = max(1, atoi(argv[++i]));
+        else if (arg == "--out" && i + 1 < argc)
+            out_dir = argv[++i];
+        else if (arg == "--switch-penalty" && i + 1 < argc)
+            switch_penalty = atof(argv[++i]);
+        else
+            inputs.push_back(arg);
+    }
+    if (inputs.empty())
+    {
+        fprintf(stderr, "usage: rnn_batch [--param file.npz] [--jobs n] [--batch n] [--out dir] "
+                "[--switch-penalty nats] dir|song ...\n");
+        return 1;
+    }
+    if (jobs < 1)
+        jobs = 1;
+
+    RNN model;
+    vector<string> songs;
+    try
+    {
+        for (size_t i = 0; i < inputs.size(); i++)
+            collect_songs(inputs[i], songs, true);
+        model.load_param(param);
+    }
+    catch (const exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    mkdir(out_dir.c_str(), 0755);
+
+    // parallelism comes from the files, so every song runs its
+    // projection on one core instead of fighting over all of them
+    if (jobs > 1)
+        model.threads = 1;
+    size_t groups = (songs.size() + batch - 1) / batch;
+    if (jobs > (int)groups)
+        jobs = (int)max<size_t>(groups, 1);
+
+    vector<BatchResult> results(songs.size());
+    output_names(out_dir, songs, results);
+    atomic<size_t> next(0);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    vector<thread> pool;
+    for (int j = 0; j < jobs; j++)
+        pool.push_back(thread([&]()
+        {
+            for (size_t n = next++; n < groups; n = next++)
+            {
+                size_t first = n * batch;
+                transcribe(model, songs, first, min<size_t>(batch, songs.size() - first),
+                           switch_penalty, results);
+            }
+        }));
+    for (size_t j = 0; j < pool.size(); j++)
+        pool[j].join();
+    double wall_ms = elapsed_ms(start);
+
+    string summary_name = out_dir + "/summary.txt";
+    FILE *summary = fopen(summary_name.c_str(), "w");
+    if (!summary)
+    {
+        fprintf(stderr, "cannot create %s\n", summary_name.c_str());
+        return 1;
+    }
+
+    int failed = 0;
+    long frames = 0;
+    vector<double> latency;
+    fprintf(summary, "# song frames notes load_ms infer_ms total_ms output\n");
+    for (size_t n = 0; n < songs.size(); n++)
+    {
+        const BatchResult &r = results[n];
+        if (!r.error.empty())
+        {
+            fprintf(summary, "%s ERR %s\n", songs[n].c_str(), r.error.c_str());
+            fprintf(stderr, "%s: %s\n", songs[n].c_str(), r.error.c_str());
+            failed++;
+            continue;
+        }
+        fprintf(summary, "%s %d %d %.2f %.2f %.2f %s\n", songs[n].c_str(), r.frames,
+                r.events, r.load_ms, r.infer_ms, r.load_ms + r.infer_ms, r.output.c_str());
+        frames += r.frames;
+        latency.push_back(r.load_ms + r.infer_ms);
+    }
+
+    sort(latency.begin(), latency.end());
+    double median = latency.empty() ? 0.0 : latency[latency.size() / 2];
+    double worst = latency.empty() ? 0.0 : latency.back();
+    fprintf(summary, "# %zu files, %d failed, %ld frames, %d jobs, batch %d, wall %.1f ms, "
+            "median %.2f ms, max %.2f ms, %.1f files/s\n",
+            songs.size(), failed, frames, jobs, batch, wall_ms, median, worst,
+            wall_ms > 0.0 ? 1000.0 * (songs.size() - failed) / wall_ms : 0.0);
+    fclose(summary);
+
+    fprintf(stdout, "%zu files (%d failed), %ld frames in %.1f ms with %d jobs, summary in %s\n",
+            songs.size(), failed, frames, wall_ms, jobs, summary_name.c_str());
+    return failed ? 1 : 0;
+}
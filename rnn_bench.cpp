@@ -0,0 +1,308 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Inference benchmark. Times every stage of the forward pass on its own
+// (input projection, recurrent step, softmax/argmax) and the whole
+// forward_prop(), for a grid of song lengths and thread counts, on
+// seeded synthetic spectra and on the bundled dirty_example_*.npz songs.
+//
+// usage: rnn_bench [--param file] [--mode dense|sparse|int8] [--T 1,16,64,256]
+//                  [--threads 1,2,4] [--reps n] [--seed n] [--no-songs]
+//                  [--shape hiddenxoutput]
+//
+// Without --param the model is random (seeded, 20000x100x12 or the
+// --shape given, e.g. 128x88), the timings only depend on the shapes.
+// Whether the shape runs on specialized or generic kernels goes to
+// stderr. One CSV row per (input, T, threads, stage) goes to stdout:
+//
+//   input,T,threads,isa,mode,stage,frames,p50_us,p90_us,p99_us,max_us,frames_per_s,peak_rss_kb
+//
+// latencies are per frame; peak_rss_kb is the process high-water mark
+// right after the row was measured.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "rnn_LSTM_CPU.h"
+
+using namespace std;
+
+typedef chrono::steady_clock bench_clock;
+
+static double elapsed_us(bench_clock::time_point since)
+{
+    return chrono::duration<double, micro>(bench_clock::now() - since).count();
+}
+
+static long peak_rss_kb()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+static vector<int> parse_list(const char *s)
+{
+    vector<int> v;
+    while (*s)
+    {
+        char *end;
+        long n = strtol(s, &end, 10);
+        if (end == s)
+            throw runtime_error(string("bad list ") + s);
+        v.push_back((int)n);
+        s = (*end == ',') ? end + 1 : end;
+    }
+    return v;
+}
+
+static void random_model(RNN &model, unsigned int seed)
+{
+    mt19937 gen(seed);
+    int I = model.input_dim, H = model.hidden_dim, O = model.output_dim;
+    normal_distribution<float> a(0.0f, 1.0f / I), r(0.0f, 1.0f / H);
+
+    AlignedFloats A((size_t)H * I);
+    for (size_t k = 0; k < A.size(); k++)
+        A[k] = a(gen);
+    model.A = SharedWeights<float>(std::move(A));
+
+    model.U.resize((size_t)4 * H * H);
+    model.W.resize((size_t)4 * H * H);
+    model.b.resize((size_t)4 * H);
+    model.V.resize((size_t)O * H);
+    model.c_o.resize(O);
+    for (size_t k = 0; k < model.U.size(); k++)
+    {
+        model.U[k] = r(gen);
+        model.W[k] = r(gen);
+    }
+    for (size_t k = 0; k < model.b.size(); k++)
+        model.b[k] = r(gen);
+    for (size_t k = 0; k < model.V.size(); k++)
+        model.V[k] = r(gen);
+    for (int k = 0; k < O; k++)
+        model.c_o[k] = r(gen);
+    model.pack();
+}
+
+struct Input
+{
+    string name;
+    vector<float> X;
+    int T;
+};
+
+struct Row
+{
+    Row() : frames(0), total_us(0.0) { }
+
+    void add(double us_per_frame, int n, double us)
+    {
+        samples.push_back(us_per_frame);
+        frames += n;
+        total_us += us;
+    }
+
+    vector<double> samples;
+    long frames;
+    double total_us;
+};
+
+static const char *mode_name(Projection p)
+{
+    switch (p)
+    {
+        case PROJECT_SPARSE: return "sparse";
+        case PROJECT_INT8:   return "int8";
+        default:             return "dense";
+    }
+}
+
+static void report(const Input &in, int threads, const RNN &model, const char *stage, Row &row)
+{
+    sort(row.samples.begin(), row.samples.end());
+    size_t n = row.samples.size();
+    double p50 = row.samples[n / 2];
+    double p90 = row.samples[min(n - 1, n * 9 / 10)];
+    double p99 = row.samples[min(n - 1, n * 99 / 100)];
+    fprintf(stdout, "%s,%d,%d,%s,%s,%s,%ld,%.3f,%.3f,%.3f,%.3f,%.1f,%ld\n",
+            in.name.c_str(), in.T, threads, lstm_isa_name(lstm_isa()),
+            mode_name(model.projection), stage, row.frames, p50, p90, p99, row.samples.back(),
+            row.total_us > 0.0 ? 1e6 * row.frames / row.total_us : 0.0, peak_rss_kb());
+    fflush(stdout);
+}
+
+static void bench(RNN &model, const Input &in, int threads, int reps)
+{
+    int T = in.T, P = model.packed.padded, O = model.output_dim;
+    model.threads = threads;
+
+    AlignedFloats x_e((size_t)T * P, 0.0f);
+    AlignedFloats s_prev(P, 0.0f), s_cur(P, 0.0f), c(P, 0.0f);
+    vector<float> out(O), probs, s;
+    Row project, step, output, forward;
+    volatile int sink = 0;
+
+    // one untimed pass to fault in the buffers and spin up the caches
+    model.forward_prop(in.X.data(), T, probs, s);
+
+    for (int r = 0; r < reps; r++)
+    {
+        bench_clock::time_point start = bench_clock::now();
+        model.project_inputs(in.X.data(), T, &x_e[0]);
+        double us = elapsed_us(start);
+        project.add(us / T, T, us);
+
+        fill(s_prev.begin(), s_prev.end(), 0.0f);
+        fill(c.begin(), c.end(), 0.0f);
+        for (int t = 0; t < T; t++)
+        {
+            start = bench_clock::now();
+            lstm_step(model.packed, &x_e[(size_t)t * P], &s_prev[0], &s_cur[0], &c[0]);
+            us = elapsed_us(start);
+            step.add(us, 1, us);
+
+            start = bench_clock::now();
+            model.output_layer(&s_cur[0], &out[0]);
+            sink += (int)(max_element(out.begin(), out.end()) - out.begin());
+            us = elapsed_us(start);
+            output.add(us, 1, us);
+            s_prev.swap(s_cur);
+        }
+
+        start = bench_clock::now();
+        model.forward_prop(in.X.data(), T, probs, s);
+        us = elapsed_us(start);
+        forward.add(us / T, T, us);
+    }
+
+    report(in, threads, model, "projection", project);
+    report(in, threads, model, "step", step);
+    report(in, threads, model, "softmax_argmax", output);
+    report(in, threads, model, "forward", forward);
+}
+
+int main(int argc, char *argv[])
+{
+    string param;
+    string mode = "dense";
+    vector<int> lengths = parse_list("1,16,64,256");
+    vector<int> thread_counts = parse_list("1");
+    int reps = 5;
+    unsigned int seed = 1;
+    bool songs = true;
+    int hidden = 0, output = 0;
+
+    try
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            string arg = argv[i];
+            if (arg == "--param" && i + 1 < argc)
+                param = argv[++i];
+            else if (arg == "--mode" && i + 1 < argc)
+                mode = argv[++i];
+            else if (arg == "--T" && i + 1 < argc)
+                lengths = parse_list(argv[++i]);
+            else if (arg == "--threads" && i + 1 < argc)
+                thread_counts = parse_list(argv[++i]);
+            else if (arg == "--reps" && i + 1 < argc)
+                reps = max(1, atoi(argv[++i]));
+            else if (arg == "--seed" && i + 1 < argc)
+                seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+            else if (arg == "--no-songs")
+                songs = false;
+            else if (arg == "--shape" && i + 1 < argc)
+            {
+                if (sscanf(argv[++i], "%dx%d", &hidden, &output) != 2 || hidden < 1 || output < 2)
+                    throw runtime_error(string("bad shape ") + argv[i]);
+            }
+            else
+                throw runtime_error("unknown option " + arg);
+        }
+
+        RNN model;
+        if (hidden)
+        {
+            model.hidden_dim = hidden;
+            model.output_dim = output;
+        }
+        if (param.empty())
+            random_model(model, seed);
+        else
+            model.load_param(param);
+        fprintf(stderr, "model %dx%dx%d, %s kernels\n", model.input_dim, model.hidden_dim,
+                model.output_dim, model.specialized() ? "specialized" : "generic");
+
+        if (mode == "dense")
+            model.set_projection(PROJECT_DENSE);
+        else if (mode == "sparse")
+            model.set_projection(PROJECT_SPARSE);
+        else if (mode == "int8")
+            model.set_projection(PROJECT_INT8);
+        else
+            throw runtime_error("unknown mode " + mode);
+
+        // synthetic spectra in the range of the recorded ones
+        vector<Input> inputs;
+        mt19937 gen(seed + 1);
+        uniform_real_distribution<float> level(0.5f, 6.0f);
+        for (size_t n = 0; n < lengths.size(); n++)
+        {
+            Input in;
+            in.name = "synthetic";
+            in.T = lengths[n];
+            in.X.resize((size_t)in.T * model.input_dim);
+            for (size_t k = 0; k < in.X.size(); k++)
+                in.X[k] = level(gen);
+            inputs.push_back(in);
+        }
+
+        if (songs)
+        {
+            const char *bundled[] = { "dirty_example_B4.npz", "dirty_example_C4.npz",
+                                      "dirty_example_G4.npz", "dirty_example_EDC.npz" };
+            for (size_t n = 0; n < sizeof(bundled) / sizeof(bundled[0]); n++)
+            {
+                Input in;
+                vector<float> Y;
+                in.name = bundled[n];
+                try
+                {
+                    in.T = get_data(bundled[n], in.X, Y);
+                    model.check_input(in.X, in.T);
+                }
+                catch (const exception &e)
+                {
+                    fprintf(stderr, "skipping %s\n", e.what());
+                    continue;
+                }
+                inputs.push_back(in);
+            }
+        }
+
+        fprintf(stdout, "input,T,threads,isa,mode,stage,frames,p50_us,p90_us,p99_us,max_us,"
+                "frames_per_s,peak_rss_kb\n");
+        for (size_t n = 0; n < inputs.size(); n++)
+        {
+            if (inputs[n].T < 1)
+                continue;
+            for (size_t j = 0; j < thread_counts.size(); j++)
+                bench(model, inputs[n], thread_counts[j], reps);
+        }
+    }
+    catch (const exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,52 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Converts the float64 parameter npz into a weight blob (weight_blob.h)
+// that every other tool accepts wherever it takes a parameter file.
+//
+// usage: rnn_blob [--int8] [parameters.npz] weights.blob
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "rnn_LSTM_CPU.h"
+#include "weight_blob.h"
+
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+    bool int8 = false;
+    vector<string> files;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--int8")
+            int8 = true;
+        else
+            files.push_back(arg);
+    }
+    if (files.size() == 1)
+        files.insert(files.begin(), RNN_PARAM_FILE);
+    if (files.size() != 2)
+    {
+        fprintf(stderr, "usage: rnn_blob [--int8] [parameters.npz] weights.blob\n");
+        return 1;
+    }
+
+    try
+    {
+        RNN model;
+        model.load_param(files[0]);
+        weight_blob_write(model, files[1], int8);
+        fprintf(stdout, "%s: %dx%dx%d %s weights\n", files[1].c_str(), model.input_dim,
+                model.hidden_dim, model.output_dim, int8 ? "int8" : "float32");
+    }
+    catch (const exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
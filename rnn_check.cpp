@@ -0,0 +1,190 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Reference equivalence check: runs the native engine on the bundled
+// songs and compares it with the golden outputs rnn_golden.py wrote from
+// the Python RNN.forward_prop(). Reports the largest probability error,
+// the argmax agreement and the edit distance between the note sequences
+// the robot would play (repeats merged), and exits with 1 as soon as one
+// of them is outside its tolerance, so a build script can gate on it.
+//
+// usage: rnn_check [--param file] [--mode dense|sparse|int8|reference]
+//                  [--isa scalar|avx2|avx512] [--max-error e]
+//                  [--min-agree fraction] [--max-edit n] [--goldens dir]
+//                  [song.npz ...]
+//
+// The golden file of dir/song.npz is testdata/song_golden.npz, or the
+// same name under --goldens. The goldens in the repo are those of
+// testdata/rnn-golden-parameters.npz, the fixed-seed model written by
+// "python rnn_golden.py --seed 10"; ctest runs the check against them.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "note_decoder.h"
+#include "npz.h"
+#include "rnn_LSTM_CPU.h"
+
+using namespace std;
+
+// default tolerances: the float32 fast path against the float64 reference
+#define CHECK_MAX_ERROR     1e-4
+#define CHECK_MIN_AGREE     1.0
+#define CHECK_MAX_EDIT      0
+
+static vector<int> played(const vector<int> &path)
+{
+    vector<NoteEvent> events = note_events(path, NULL, 0);
+    vector<int> notes(events.size());
+    for (size_t e = 0; e < events.size(); e++)
+        notes[e] = events[e].note;
+    return notes;
+}
+
+static int edit_distance(const vector<int> &a, const vector<int> &b)
+{
+    vector<int> row(b.size() + 1), next(b.size() + 1);
+    for (size_t j = 0; j <= b.size(); j++)
+        row[j] = (int)j;
+    for (size_t i = 1; i <= a.size(); i++)
+    {
+        next[0] = (int)i;
+        for (size_t j = 1; j <= b.size(); j++)
+            next[j] = min(min(row[j] + 1, next[j - 1] + 1),
+                          row[j - 1] + (a[i - 1] != b[j - 1]));
+        row.swap(next);
+    }
+    return row[b.size()];
+}
+
+int main(int argc, char *argv[])
+{
+    string param = RNN_PARAM_FILE;
+    string mode = "dense";
+    string goldens = "testdata";
+    double max_error = CHECK_MAX_ERROR;
+    double min_agree = CHECK_MIN_AGREE;
+    int max_edit = CHECK_MAX_EDIT;
+    vector<string> songs;
+
+    try
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            string arg = argv[i];
+            if (arg == "--param" && i + 1 < argc)
+                param = argv[++i];
+            else if (arg == "--mode" && i + 1 < argc)
+                mode = argv[++i];
+            else if (arg == "--isa" && i + 1 < argc)
+            {
+                string isa = argv[++i];
+                if (isa == "scalar")
+                    lstm_set_isa(LSTM_ISA_SCALAR);
+                else if (isa == "avx2")
+                    lstm_set_isa(LSTM_ISA_AVX2);
+                else if (isa == "avx512")
+                    lstm_set_isa(LSTM_ISA_AVX512);
+                else
+                    throw runtime_error("unknown isa " + isa);
+            }
+            else if (arg == "--max-error" && i + 1 < argc)
+                max_error = atof(argv[++i]);
+            else if (arg == "--min-agree" && i + 1 < argc)
+                min_agree = atof(argv[++i]);
+            else if (arg == "--max-edit" && i + 1 < argc)
+                max_edit = atoi(argv[++i]);
+            else if (arg == "--goldens" && i + 1 < argc)
+                goldens = argv[++i];
+            else
+                songs.push_back(arg);
+        }
+        if (songs.empty())
+        {
+            songs.push_back("dirty_example_B4.npz");
+            songs.push_back("dirty_example_C4.npz");
+            songs.push_back("dirty_example_G4.npz");
+            songs.push_back("dirty_example_EDC.npz");
+        }
+
+        RNN model;
+        model.load_param(param);
+        // an int8 weight blob has no float A, it can only run int8
+        if (model.A.empty() && mode != "int8")
+            throw runtime_error(param + " is an int8 weight blob, check it with --mode int8");
+        if (mode == "sparse")
+            model.set_projection(PROJECT_SPARSE);
+        else if (mode == "int8")
+            model.set_projection(PROJECT_INT8);
+        else if (mode != "dense" && mode != "reference")
+            throw runtime_error("unknown mode " + mode);
+
+        int O = model.output_dim;
+        bool pass = true;
+        size_t frames = 0, agree = 0;
+        double worst = 0.0;
+        for (size_t n = 0; n < songs.size(); n++)
+        {
+            size_t slash = songs[n].find_last_of('/');
+            string stem = songs[n].substr(slash == string::npos ? 0 : slash + 1);
+            string golden_file = goldens + "/" + stem.substr(0, stem.size() - 4) + "_golden.npz";
+            NpzFile golden(golden_file);
+            const NpyArray &g = golden["out"];
+
+            vector<float> X, Y, out, s;
+            int T = get_data(songs[n], X, Y);
+            if (g.shape.size() != 2 || g.shape[0] != (size_t)T || g.shape[1] != (size_t)O)
+                throw runtime_error(golden_file + ": does not match the song and model");
+            vector<double> ref = g.as_double();
+
+            model.check_input(X, T);
+            if (mode == "reference")
+                model.forward_prop_reference(X.data(), T, out, s);
+            else
+                model.forward_prop(X.data(), T, out, s);
+
+            double err = 0.0;
+            vector<int> ref_path(T), path(T);
+            for (int t = 0; t < T; t++)
+            {
+                const double *r = &ref[(size_t)t * O];
+                const float *o = &out[(size_t)t * O];
+                for (int k = 0; k < O; k++)
+                {
+                    err = max(err, fabs(r[k] - o[k]));
+                    if (r[k] > r[ref_path[t]])
+                        ref_path[t] = k;
+                    if (o[k] > o[path[t]])
+                        path[t] = k;
+                }
+            }
+            int same = 0;
+            for (int t = 0; t < T; t++)
+                same += (ref_path[t] == path[t]);
+            int edit = edit_distance(played(ref_path), played(path));
+
+            bool ok = err <= max_error && edit <= max_edit &&
+                      (T == 0 || (double)same / T >= min_agree);
+            fprintf(stdout, "%s %s: T=%d max|dp|=%.3g argmax agree=%d/%d edit=%d\n",
+                    ok ? "PASS" : "FAIL", songs[n].c_str(), T, err, same, T, edit);
+            pass = pass && ok;
+            frames += T;
+            agree += same;
+            worst = max(worst, err);
+        }
+
+        fprintf(stdout, "%s: %s/%s max|dp|=%.3g (<= %g) argmax agree=%.1f%% (>= %.1f%%)\n",
+                pass ? "PASS" : "FAIL", mode.c_str(), lstm_isa_name(lstm_isa()), worst, max_error,
+                frames ? 100.0 * agree / frames : 100.0, 100.0 * min_agree);
+        return pass ? 0 : 1;
+    }
+    catch (const exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 2;
+    }
+}
@@ -0,0 +1,193 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Client side of rnn_server, see rnn_client.h.
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "rnn_client.h"
+
+using namespace std;
+
+bool rnn_write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = (const char *)buf;
+    while (len > 0)
+    {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool rnn_read_all(int fd, void *buf, size_t len)
+{
+    char *p = (char *)buf;
+    while (len > 0)
+    {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool rnn_read_line(int fd, string &line)
+{
+    line.clear();
+    char ch;
+    while (rnn_read_all(fd, &ch, 1))
+    {
+        if (ch == '\n')
+            return true;
+        line += ch;
+    }
+    return false;
+}
+
+// connect with send/receive timeouts applied to the socket
+static int connect_server(const string &socket_path, double timeout)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw runtime_error("rnn_server: cannot create socket");
+
+    struct timeval tv;
+    tv.tv_sec = (long)timeout;
+    tv.tv_usec = (long)((timeout - (double)tv.tv_sec) * 1e6);
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        throw runtime_error("rnn_server: cannot connect to " + socket_path);
+    }
+    return fd;
+}
+
+static vector<int> read_reply(int fd)
+{
+    string line;
+    bool ok = rnn_read_line(fd, line);
+    close(fd);
+    if (!ok)
+        throw runtime_error("rnn_server: no reply (timeout?)");
+    if (line.compare(0, 3, "OK ") != 0)
+        throw runtime_error("rnn_server: " + line);
+
+    const char *p = line.c_str() + 3;
+    char *end;
+    long T = strtol(p, &end, 10);
+    vector<int> notes;
+    for (long t = 0; t < T; t++)
+    {
+        p = end;
+        long note = strtol(p, &end, 10);
+        if (end == p)
+            throw runtime_error("rnn_server: short reply");
+        notes.push_back((int)note);
+    }
+    return notes;
+}
+
+// the server runs in its own working directory
+static string absolute_path(const string &song)
+{
+    char resolved[PATH_MAX];
+    return realpath(song.c_str(), resolved) ? string(resolved) : song;
+}
+
+vector<int> rnn_server_predict_file(const string &socket_path, const string &song,
+                                    double timeout)
+{
+    int fd = connect_server(socket_path, timeout);
+    string request = "FILE " + absolute_path(song) + "\n";
+    if (!rnn_write_all(fd, request.c_str(), request.size()))
+    {
+        close(fd);
+        throw runtime_error("rnn_server: cannot send request");
+    }
+    return read_reply(fd);
+}
+
+vector<NoteRecord> rnn_server_decode_file(const string &socket_path, const string &song,
+                                          double switch_penalty, double timeout)
+{
+    int fd = connect_server(socket_path, timeout);
+    char penalty[32];
+    snprintf(penalty, sizeof(penalty), "%.17g", switch_penalty);
+    string request = string("DECODE ") + penalty + " " + absolute_path(song) + "\n";
+    string line;
+    if (!rnn_write_all(fd, request.c_str(), request.size()) || !rnn_read_line(fd, line))
+    {
+        close(fd);
+        throw runtime_error("rnn_server: no reply (timeout?)");
+    }
+    if (line != "EVENTS")
+    {
+        close(fd);
+        throw runtime_error("rnn_server: " + line);
+    }
+
+    NoteStreamReader reader;
+    char buf[4096];
+    ssize_t n;
+    while (!reader.complete() && (n = recv(fd, buf, sizeof(buf), 0)) != 0)
+    {
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            break;
+        try
+        {
+            reader.feed(buf, n);
+        }
+        catch (...)
+        {
+            close(fd);
+            throw;
+        }
+    }
+    close(fd);
+    if (!reader.complete())
+        throw runtime_error("rnn_server: truncated note stream");
+    return reader.records;
+}
+
+vector<int> rnn_server_predict_frames(const string &socket_path, const float *x, int T,
+                                      int dim, double timeout)
+{
+    int fd = connect_server(socket_path, timeout);
+    char request[64];
+    snprintf(request, sizeof(request), "FRAMES %d %d\n", T, dim);
+    if (!rnn_write_all(fd, request, strlen(request)) ||
+        !rnn_write_all(fd, x, (size_t)T * dim * sizeof(float)))
+    {
+        close(fd);
+        throw runtime_error("rnn_server: cannot send request");
+    }
+    return read_reply(fd);
+}
@@ -0,0 +1,48 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Client side of rnn_server, the long lived process that keeps the LSTM
+// loaded so a transcription costs milliseconds instead of a full model
+// load.
+//
+// The protocol is one request per connection over a local UNIX socket:
+//
+//   FILE <path>\n                      transcribe an npz song on disk
+//   FRAMES <T> <dim>\n<T*dim float32>  transcribe frames sent inline
+//   DECODE <switch_penalty> <path>\n    decode an npz or wav song into notes
+//
+// FILE and FRAMES are answered by "OK <T> <note> <note> ...\n", the
+// argmax of every frame. DECODE runs the Viterbi decoder of
+// note_decoder.h and answers "EVENTS\n" followed by a note stream
+// (note_stream.h) with confidence and timing of every note. Errors are
+// answered by "ERR <message>\n".
+
+#ifndef RNN_CLIENT_H
+#define RNN_CLIENT_H
+
+#include <string>
+#include <vector>
+
+#include "note_stream.h"
+
+#define RNN_SERVER_SOCKET   "/tmp/rnn_server.sock"
+
+// both throw std::runtime_error when the server cannot be reached, does
+// not answer within timeout seconds or reports an error
+std::vector<int> rnn_server_predict_file(const std::string &socket_path,
+                                         const std::string &song, double timeout);
+
+std::vector<int> rnn_server_predict_frames(const std::string &socket_path,
+                                           const float *x, int T, int dim,
+                                           double timeout);
+
+// the note events of a song on disk, decoded with switch_penalty
+std::vector<NoteRecord> rnn_server_decode_file(const std::string &socket_path,
+                                               const std::string &song,
+                                               double switch_penalty, double timeout);
+
+// helpers shared with the server
+bool rnn_write_all(int fd, const void *buf, size_t len);
+bool rnn_read_all(int fd, void *buf, size_t len);
+bool rnn_read_line(int fd, std::string &line);
+
+#endif
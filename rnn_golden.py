@@ -0,0 +1,68 @@
+import os
+import sys
+import numpy as np
+from rnn_LSTM_CPU import RNN, get_data
+
+#Writes the golden outputs rnn_check compares the native engine against:
+#testdata/<song>_golden.npz with the reference softmax output "out" (T, 12),
+#float64, and its argmax "notes". They are kept out of the song directory,
+#which rnn_train and rnn_batch scan for songs.
+#usage: python rnn_golden.py [parameters.npz] [song.npz ...]
+#       python rnn_golden.py --seed n [song.npz ...]
+#
+#With --seed the model is not trained but drawn from a fixed seed and
+#written to testdata/rnn-golden-parameters.npz first, so the goldens can ship with
+#the repo and the build can check against them without the real parameter
+#file. Its weights are sparse multiples of 1/512 stored as float32, which
+#keeps the compressed file small, and the reference runs in float64.
+
+SONGS = ["dirty_example_B4.npz", "dirty_example_C4.npz",
+         "dirty_example_G4.npz", "dirty_example_EDC.npz"]
+
+GOLDEN_DIR = "testdata"
+GOLDEN_PARAM = os.path.join(GOLDEN_DIR, "rnn-golden-parameters.npz")
+GOLDEN_DENSITY = 0.05
+
+def seeded_model(seed):
+    rng = np.random.RandomState(seed)
+    model = RNN()
+    H, I, O = model.hidden_dim, model.input_dim, model.output_dim
+    A = rng.randint(-8, 9, (H, I)) * (rng.rand(H, I) < GOLDEN_DENSITY)
+    model.A = np.float32(A / 512.)
+    model.U = np.float32(rng.randint(-64, 65, (4, H, H)) / 256.)
+    model.W = np.float32(rng.randint(-64, 65, (4, H, H)) / 256.)
+    model.b = np.float32(rng.randint(-64, 65, (4, H)) / 128.)
+    model.V = np.float32(rng.randint(-64, 65, (O, H)) / 32.)
+    model.c_o = np.float32(rng.randint(-64, 65, O) / 64.)
+    if not os.path.isdir(GOLDEN_DIR):
+        os.makedirs(GOLDEN_DIR)
+    np.savez_compressed(GOLDEN_PARAM, A=model.A, U=model.U, V=model.V, W=model.W,
+                        b=model.b, c_o=model.c_o)
+    print("seed %d -> %s" % (seed, GOLDEN_PARAM))
+    return model
+
+def write_golden(model, song):
+    X, Y = get_data(song)
+    o, s = model.forward_prop(np.float32(X))
+    o = np.asarray(o, dtype=np.float64)
+    if not os.path.isdir(GOLDEN_DIR):
+        os.makedirs(GOLDEN_DIR)
+    golden = os.path.join(GOLDEN_DIR, os.path.basename(song)[:-len(".npz")] + "_golden.npz")
+    np.savez(golden, out=o, notes=np.argmax(o, axis=1))
+    print("%s: %d frames -> %s" % (song, o.shape[0], golden))
+
+if __name__ == "__main__":
+    if len(sys.argv) > 2 and sys.argv[1] == "--seed":
+        model = seeded_model(int(sys.argv[2]))
+        songs = sys.argv[3:] if len(sys.argv) > 3 else SONGS
+    else:
+        param = sys.argv[1] if len(sys.argv) > 1 else "rnn-theano-parameters-one-octave-songs-2.npz"
+        songs = sys.argv[2:] if len(sys.argv) > 2 else SONGS
+        model = RNN()
+        model.load_param(param)
+
+    # the reference in float64, whatever the file stored
+    for name in ["A", "U", "V", "W", "b", "c_o"]:
+        setattr(model, name, np.float64(getattr(model, name)))
+    for song in songs:
+        write_golden(model, song)
@@ -0,0 +1,41 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Native drop-in for call_python: runs the LSTM on a song and prints
+// the predicted note of every frame, space separated.
+//
+// usage: rnn_predict [song.npz] [parameters.npz]
+
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "rnn_LSTM_CPU.h"
+
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+    string song = (argc > 1) ? argv[1] : RNN_DEFAULT_SONG;
+    string param = (argc > 2) ? argv[2] : RNN_PARAM_FILE;
+
+    try
+    {
+        RNN model;
+        model.load_param(param);
+
+        vector<float> X, Y;
+        int T = get_data(song, X, Y);
+        vector<int> notes = model.predict(X, T);
+
+        for (size_t j = 0; j < notes.size(); j++)
+            cout << notes[j] << ' ';
+    }
+    catch (const exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
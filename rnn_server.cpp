@@ -0,0 +1,217 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Long lived inference server: loads the LSTM parameters once and answers
+// transcription requests over a local UNIX socket (protocol in
+// rnn_client.h), so the controller no longer boots an interpreter and
+// re-reads the model for every song.
+//
+// usage: rnn_server [--socket path] [--param file.npz] [--threads n]
+//                   [--workers n]
+//
+// Up to --workers requests (default: one per core) run at once, each on
+// --threads threads (default 1), so concurrent clients do not
+// oversubscribe the CPU; further connections wait in the listen backlog.
+
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "note_decoder.h"
+#include "rnn_LSTM_CPU.h"
+#include "rnn_client.h"
+
+using namespace std;
+
+#define SERVER_RECV_TIMEOUT     30      // [s] a client has to send its request
+#define SERVER_ACCEPT_BACKOFF   100000  // [us] before accepting again after a failure
+
+// connections being served, at most the --workers limit
+static mutex workers_mutex;
+static condition_variable workers_free;
+static int workers_busy = 0;
+
+static string reply_notes(const vector<int> &notes)
+{
+    ostringstream reply;
+    reply << "OK " << notes.size();
+    for (size_t j = 0; j < notes.size(); j++)
+        reply << ' ' << notes[j];
+    reply << '\n';
+    return reply.str();
+}
+
+// the Viterbi decoded notes of a song, confidence and timing included
+static string reply_events(const RNN *model, const string &song, double switch_penalty)
+{
+    vector<float> X, Y;
+    int T = get_data(song, X, Y);
+    Prediction p = model->predict_with_confidence(X, T);
+    vector<NoteEvent> events = decode_notes(p.probabilities.data(), T, model->output_dim,
+                                            switch_penalty);
+
+    vector<NoteRecord> records(events.size());
+    for (size_t e = 0; e < events.size(); e++)
+    {
+        records[e].note = events[e].note;
+        records[e].confidence = events[e].confidence;
+        records[e].onset = events[e].onset;
+        records[e].duration = events[e].duration;
+    }
+    vector<char> stream = note_stream_encode(records, NOTE_STREAM_CONFIDENCE | NOTE_STREAM_TIMING);
+    return "EVENTS\n" + string(stream.begin(), stream.end());
+}
+
+static void serve(const RNN *model, int fd)
+{
+    string reply;
+    try
+    {
+        string line;
+        if (!rnn_read_line(fd, line))
+            throw runtime_error("truncated request");
+
+        if (line.compare(0, 5, "FILE ") == 0)
+        {
+            vector<float> X, Y;
+            int T = get_data(line.substr(5), X, Y);
+            reply = reply_notes(model->predict(X, T));
+        }
+        else if (line.compare(0, 7, "DECODE ") == 0)
+        {
+            double switch_penalty;
+            int skip = 0;
+            if (sscanf(line.c_str() + 7, "%lf %n", &switch_penalty, &skip) != 1 || skip == 0)
+                throw runtime_error("bad DECODE header");
+            reply = reply_events(model, line.substr(7 + skip), switch_penalty);
+        }
+        else if (line.compare(0, 7, "FRAMES ") == 0)
+        {
+            int T = 0, dim = 0;
+            if (sscanf(line.c_str() + 7, "%d %d", &T, &dim) != 2 || T < 0)
+                throw runtime_error("bad FRAMES header");
+            if (dim != model->input_dim)
+                throw runtime_error("frames do not match the model input size");
+
+            vector<float> X((size_t)T * dim);
+            if (!rnn_read_all(fd, X.data(), X.size() * sizeof(float)))
+                throw runtime_error("truncated frames");
+            reply = reply_notes(model->predict(X.data(), T));
+        }
+        else
+            throw runtime_error("unknown request");
+    }
+    catch (const exception &e)
+    {
+        reply = string("ERR ") + e.what() + "\n";
+    }
+
+    rnn_write_all(fd, reply.c_str(), reply.size());
+    close(fd);
+
+    lock_guard<mutex> lock(workers_mutex);
+    workers_busy--;
+    workers_free.notify_one();
+}
+
+int main(int argc, char *argv[])
+{
+    string socket_path = RNN_SERVER_SOCKET;
+    string param = RNN_PARAM_FILE;
+    int threads = 1;
+    int workers = (int)thread::hardware_concurrency();
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        string arg = argv[i];
+        if (arg == "--socket")
+            socket_path = argv[i + 1];
+        else if (arg == "--param")
+            param = argv[i + 1];
+        else if (arg == "--threads")
+            threads = atoi(argv[i + 1]);
+        else if (arg == "--workers")
+            workers = atoi(argv[i + 1]);
+        else
+        {
+            fprintf(stderr, "unknown option %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    RNN model;
+    try
+    {
+        model.load_param(param);
+    }
+    catch (const exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    model.threads = threads;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(socket_path.c_str());
+    if (server < 0 || bind(server, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(server, 16) < 0)
+    {
+        fprintf(stderr, "cannot listen on %s\n", socket_path.c_str());
+        return 1;
+    }
+    fprintf(stdout, "rnn_server: model %s loaded, listening on %s\n",
+            param.c_str(), socket_path.c_str());
+    fflush(stdout);
+
+    if (workers < 1)
+        workers = 1;
+
+    // the model is only read after loading, so requests run concurrently
+    struct timeval recv_timeout;
+    recv_timeout.tv_sec = SERVER_RECV_TIMEOUT;
+    recv_timeout.tv_usec = 0;
+    while (true)
+    {
+        {
+            unique_lock<mutex> lock(workers_mutex);
+            workers_free.wait(lock, [&]() { return workers_busy < workers; });
+        }
+
+        int fd = accept(server, NULL, NULL);
+        if (fd < 0)
+        {
+            // out of descriptors or memory: give the workers time to
+            // release some instead of spinning
+            if (errno != EINTR)
+                usleep(SERVER_ACCEPT_BACKOFF);
+            continue;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &recv_timeout, sizeof(recv_timeout));
+
+        {
+            lock_guard<mutex> lock(workers_mutex);
+            workers_busy++;
+        }
+        thread(serve, &model, fd).detach();
+    }
+    return 0;
+}
@@ -0,0 +1,210 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Retrains the LSTM on labelled recordings (song npz files with "data"
+// and "out", as written for rnn_LSTM_CPU.py) with the truncated BPTT
+// trainer of rnn_trainer.h, and writes the parameter npz every other
+// tool loads.
+//
+// usage: rnn_train [--init params.npz] [--shape hiddenxoutput] [--out file.npz]
+//                  [--epochs n] [--batch n] [--lr rate] [--bptt n]
+//                  [--threads n] [--val fraction] [--seed n] dir|song ...
+//
+// Without --init the model starts from random weights (100x12 unless
+// --shape says otherwise), with it training continues from that file,
+// e.g. to adapt the shipped model to another keyboard or room. A
+// --val fraction of the songs is held out; the parameters are written
+// after every epoch that improves the held-out loss (every epoch when
+// nothing is held out). Files that cannot be read or have no labels are
+// skipped with a warning.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "rnn_trainer.h"
+
+using namespace std;
+
+#define TRAIN_PARAM_FILE    "rnn-parameters-trained.npz"
+#define TRAIN_EPOCHS        20
+
+static void print_stats(const char *what, const TrainStats &s)
+{
+    fprintf(stdout, " %s loss %.4f acc %.1f%%", what, s.frames ? s.loss / s.frames : 0.0,
+            s.frames ? 100.0 * s.correct / s.frames : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+    string init, out = TRAIN_PARAM_FILE;
+    int hidden = 100, output = 12;
+    int epochs = TRAIN_EPOCHS, batch = TRAIN_BATCH, bptt = TRAIN_BPTT_TRUNCATE, threads = 0;
+    double lr = TRAIN_LEARNING_RATE, val = 0.0;
+    unsigned int seed = 10;
+    vector<string> inputs;
+
+    try
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            string arg = argv[i];
+            if (arg == "--init" && i + 1 < argc)
+                init = argv[++i];
+            else if (arg == "--shape" && i + 1 < argc)
+            {
+                if (sscanf(argv[++i], "%dx%d", &hidden, &output) != 2 || hidden < 1 || output < 2)
+                    throw runtime_error(string("bad shape ") + argv[i]);
+            }
+            else if (arg == "--out" && i + 1 < argc)
+                out = argv[++i];
+            else if (arg == "--epochs" && i + 1 < argc)
+                epochs = atoi(argv[++i]);
+            else if (arg == "--batch" && i + 1 < argc)
+                batch = max(1, atoi(argv[++i]));
+            else if (arg == "--lr" && i + 1 < argc)
+                lr = atof(argv[++i]);
+            else if (arg == "--bptt" && i + 1 < argc)
+                bptt = atoi(argv[++i]);
+            else if (arg == "--threads" && i + 1 < argc)
+                threads = atoi(argv[++i]);
+            else if (arg == "--val" && i + 1 < argc)
+                val = atof(argv[++i]);
+            else if (arg == "--seed" && i + 1 < argc)
+                seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+            else
+                inputs.push_back(arg);
+        }
+        if (inputs.empty())
+        {
+            fprintf(stderr, "usage: rnn_train [--init params.npz] [--shape hiddenxoutput] "
+                    "[--out file.npz] [--epochs n] [--batch n] [--lr rate] [--bptt n] "
+                    "[--threads n] [--val fraction] [--seed n] dir|song ...\n");
+            return 1;
+        }
+
+        vector<string> files;
+        for (size_t i = 0; i < inputs.size(); i++)
+            collect_songs(inputs[i], files, false);
+
+        // one unreadable or unlabelled file does not end the run
+        vector<TrainSong> songs;
+        long frames = 0;
+        for (size_t n = 0; n < files.size(); n++)
+        {
+            TrainSong s;
+            s.name = files[n];
+            try
+            {
+                s.T = get_data(files[n], s.X, s.Y);
+                if (s.Y.empty())
+                    throw runtime_error(files[n] + ": no labels (\"out\")");
+            }
+            catch (const exception &e)
+            {
+                fprintf(stderr, "skipped %s\n", e.what());
+                continue;
+            }
+            frames += s.T;
+            songs.push_back(std::move(s));
+        }
+        if (songs.empty())
+            throw runtime_error("no songs found");
+
+        RNN model;
+        if (!init.empty())
+            model.load_param(init);
+        else
+        {
+            // the real dimensions come from the data and --shape
+            model.input_dim = songs[0].T ? (int)(songs[0].X.size() / songs[0].T) : INPUT_DIM;
+            model.hidden_dim = hidden;
+            model.output_dim = output;
+            model.A = SharedWeights<float>(AlignedFloats((size_t)hidden * model.input_dim));
+            model.U.resize((size_t)4 * hidden * hidden);
+            model.W.resize((size_t)4 * hidden * hidden);
+            model.b.resize((size_t)4 * hidden);
+            model.V.resize((size_t)output * hidden);
+            model.c_o.resize(output);
+        }
+
+        for (size_t n = 0; n < songs.size(); n++)
+        {
+            model.check_input(songs[n].X, songs[n].T);
+            if (songs[n].Y.size() != (size_t)songs[n].T * model.output_dim)
+                throw runtime_error(songs[n].name + ": out does not match the model output size");
+        }
+
+        RNNTrainer trainer(model, bptt, threads);
+        trainer.learning_rate = lr;
+        if (init.empty())
+            trainer.randomize(seed);
+
+        // shuffled once for the held-out split, then every epoch
+        mt19937 gen(seed);
+        vector<const TrainSong *> order(songs.size());
+        for (size_t n = 0; n < songs.size(); n++)
+            order[n] = &songs[n];
+        shuffle(order.begin(), order.end(), gen);
+        size_t held = (size_t)(val * order.size());
+        if (held >= order.size())
+            held = order.size() - 1;
+        vector<const TrainSong *> test(order.begin(), order.begin() + held);
+        vector<const TrainSong *> train(order.begin() + held, order.end());
+
+        fprintf(stdout, "%zu songs (%ld frames), %zu held out, model %dx%dx%d, bptt %d, "
+                "batch %d\n", songs.size(), frames, test.size(), model.input_dim,
+                model.hidden_dim, model.output_dim, bptt, batch);
+
+        double best = 1e300;
+        for (int epoch = 1; epoch <= epochs; epoch++)
+        {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            shuffle(train.begin(), train.end(), gen);
+
+            TrainStats total;
+            for (size_t n0 = 0; n0 < train.size(); n0 += batch)
+            {
+                vector<const TrainSong *> mini(train.begin() + n0,
+                                               train.begin() + min(train.size(), n0 + batch));
+                TrainStats s = trainer.step(mini);
+                total.loss += s.loss;
+                total.frames += s.frames;
+                total.correct += s.correct;
+            }
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            fprintf(stdout, "epoch %d:", epoch);
+            print_stats("train", total);
+            double score = total.frames ? total.loss / total.frames : 0.0;
+            if (!test.empty())
+            {
+                TrainStats t = trainer.evaluate(test);
+                print_stats("val", t);
+                score = t.frames ? t.loss / t.frames : 0.0;
+            }
+            fprintf(stdout, " %.1f s", seconds);
+
+            if (test.empty() || score < best)
+            {
+                best = score;
+                trainer.store(model);
+                model.save_param(out);
+                fprintf(stdout, ", saved %s", out.c_str());
+            }
+            fprintf(stdout, "\n");
+            fflush(stdout);
+        }
+    }
+    catch (const exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,419 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Truncated BPTT trainer, see rnn_trainer.h.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+#include "rnn_trainer.h"
+
+using namespace std;
+
+// log() of the softmax output is taken no lower than this
+#define TRAIN_FLOOR     1e-12
+
+// input bins per block of the A gradient, which stays in L1 while the
+// frames of a song are added to it
+#define TRAIN_KC        2048
+
+static float hard_sigmoid(float x)
+{
+    x = x * 0.2f + 0.5f;
+    return x < 0.0f ? 0.0f : (x > 1.0f ? 1.0f : x);
+}
+
+// derivative of hard_sigmoid() at the pre-activation z
+static float hard_sigmoid_grad(float z)
+{
+    return (z > -2.5f && z < 2.5f) ? 0.2f : 0.0f;
+}
+
+// per-song buffers of one worker, (T, n) row major
+struct RNNTrainer::Workspace
+{
+    vector<float> x_e;      // (T, H) A.dot(x[t])
+    vector<float> z;        // (T, 4H) gate pre-activations [i, f, o, g]
+    vector<float> a;        // (T, 4H) gate activations
+    vector<float> c;        // (T, H)
+    vector<float> s;        // (T, H)
+    vector<float> dz;       // (T, 4H) loss gradient of z, summed over the windows
+    vector<float> dx_e;     // (T, H)
+    vector<float> ds, dc, step, zero;
+    vector<double> o;
+};
+
+RNNTrainer::RNNTrainer(const RNN &model, int bptt_truncate, int threads) :
+    input_dim(model.input_dim), hidden_dim(model.hidden_dim), output_dim(model.output_dim),
+    bptt_truncate(bptt_truncate), threads(threads)
+{
+    if (model.A.empty())
+        throw runtime_error("trainer: the model has no float A (int8 weight blob?)");
+    if (bptt_truncate < 0)
+        throw runtime_error("trainer: negative bptt_truncate");
+
+    learning_rate = TRAIN_LEARNING_RATE;
+    clip = TRAIN_CLIP;
+    if (this->threads <= 0)
+        this->threads = max(1, (int)thread::hardware_concurrency());
+
+    size_t I = input_dim, H = hidden_dim, O = output_dim;
+    off_A = 0;
+    off_U = off_A + H * I;
+    off_W = off_U + 4 * H * H;
+    off_b = off_W + 4 * H * H;
+    off_V = off_b + 4 * H;
+    off_c = off_V + O * H;
+    theta.resize(off_c + O);
+
+    copy(model.A.data(), model.A.data() + H * I, theta.begin() + off_A);
+    copy(model.U.begin(), model.U.end(), theta.begin() + off_U);
+    copy(model.W.begin(), model.W.end(), theta.begin() + off_W);
+    copy(model.b.begin(), model.b.end(), theta.begin() + off_b);
+    copy(model.V.begin(), model.V.end(), theta.begin() + off_V);
+    copy(model.c_o.begin(), model.c_o.end(), theta.begin() + off_c);
+
+    m.assign(theta.size(), 0.0f);
+    v.assign(theta.size(), 0.0f);
+    updates = 0;
+}
+
+void RNNTrainer::randomize(unsigned int seed)
+{
+    mt19937 gen(seed);
+    float ra = (float)sqrt(1.0 / input_dim);
+    float rh = (float)sqrt(1.0 / hidden_dim);
+    uniform_real_distribution<float> a(-ra, ra), h(-rh, rh);
+
+    for (size_t k = off_A; k < off_U; k++)
+        theta[k] = a(gen);
+    for (size_t k = off_U; k < off_b; k++)
+        theta[k] = h(gen);
+    fill(theta.begin() + off_b, theta.begin() + off_V, 0.0f);
+    for (size_t k = off_V; k < off_c; k++)
+        theta[k] = h(gen);
+    fill(theta.begin() + off_c, theta.end(), 0.0f);
+
+    fill(m.begin(), m.end(), 0.0f);
+    fill(v.begin(), v.end(), 0.0f);
+    updates = 0;
+}
+
+TrainStats RNNTrainer::song_gradient(const TrainSong &song, float *grad, Workspace &ws) const
+{
+    int T = song.T, I = input_dim, H = hidden_dim, O = output_dim;
+    size_t HH = (size_t)H * H;
+    const float *A = &theta[off_A];
+    const float *U = &theta[off_U];
+    const float *W = &theta[off_W];
+    const float *b = &theta[off_b];
+    const float *V = &theta[off_V];
+    const float *c_o = &theta[off_c];
+
+    ws.x_e.assign((size_t)T * H, 0.0f);
+    ws.z.assign((size_t)T * 4 * H, 0.0f);
+    ws.a.assign((size_t)T * 4 * H, 0.0f);
+    ws.c.assign((size_t)T * H, 0.0f);
+    ws.s.assign((size_t)T * H, 0.0f);
+    ws.zero.assign(H, 0.0f);
+    ws.o.resize(O);
+    if (grad)
+    {
+        ws.dz.assign((size_t)T * 4 * H, 0.0f);
+        ws.step.resize(4 * H);
+    }
+
+    lstm_project(A, song.X.data(), T, H, I, &ws.x_e[0], H, 1);
+
+    TrainStats stats;
+    for (int t = 0; t < T; t++)
+    {
+        const float *x_e = &ws.x_e[(size_t)t * H];
+        const float *s_prev = t ? &ws.s[(size_t)(t - 1) * H] : &ws.zero[0];
+        const float *c_prev = t ? &ws.c[(size_t)(t - 1) * H] : &ws.zero[0];
+        float *z = &ws.z[(size_t)t * 4 * H];
+        float *a = &ws.a[(size_t)t * 4 * H];
+        float *c = &ws.c[(size_t)t * H];
+        float *s = &ws.s[(size_t)t * H];
+
+        for (int k = 0; k < 4; k++)
+        {
+            // the g gate uses b[2], exactly like RNN.forward_prop()
+            const float *bk = b + (size_t)(k == 3 ? 2 : k) * H;
+            for (int r = 0; r < H; r++)
+            {
+                const float *u = U + k * HH + (size_t)r * H;
+                const float *w = W + k * HH + (size_t)r * H;
+                float acc = bk[r];
+                for (int j = 0; j < H; j++)
+                    acc += u[j] * x_e[j] + w[j] * s_prev[j];
+                z[k * H + r] = acc;
+                a[k * H + r] = (k == 3) ? tanhf(acc) : hard_sigmoid(acc);
+            }
+        }
+        for (int r = 0; r < H; r++)
+        {
+            c[r] = c_prev[r] * a[H + r] + a[3 * H + r] * a[r];
+            s[r] = tanhf(c[r]) * a[2 * H + r];
+        }
+
+        double top = -1e300;
+        for (int k = 0; k < O; k++)
+        {
+            const float *vk = V + (size_t)k * H;
+            double acc = c_o[k];
+            for (int j = 0; j < H; j++)
+                acc += vk[j] * s[j];
+            ws.o[k] = acc;
+            top = max(top, acc);
+        }
+        double sum = 0.0;
+        for (int k = 0; k < O; k++)
+        {
+            ws.o[k] = exp(ws.o[k] - top);
+            sum += ws.o[k];
+        }
+
+        const float *y = &song.Y[(size_t)t * O];
+        double y_sum = 0.0;
+        int best = 0, label = 0;
+        for (int k = 0; k < O; k++)
+        {
+            ws.o[k] /= sum;
+            if (y[k] != 0.0f)
+                stats.loss -= y[k] * log(max(ws.o[k], TRAIN_FLOOR));
+            y_sum += y[k];
+            if (ws.o[k] > ws.o[best])
+                best = k;
+            if (y[k] > y[label])
+                label = k;
+        }
+        // frames without a label only feed the recurrence
+        if (y_sum > 0.0)
+        {
+            stats.frames++;
+            stats.correct += (best == label);
+        }
+        if (!grad || y_sum <= 0.0)
+            continue;
+        for (int k = 0; k < O; k++)
+            ws.o[k] = ws.o[k] * y_sum - y[k];
+
+        // output layer; ws.o now holds d loss / d logits
+        float *gV = grad + off_V;
+        float *gc = grad + off_c;
+        ws.ds.assign(H, 0.0f);
+        for (int k = 0; k < O; k++)
+        {
+            float d = (float)ws.o[k];
+            const float *vk = V + (size_t)k * H;
+            float *gvk = gV + (size_t)k * H;
+            gc[k] += d;
+            for (int j = 0; j < H; j++)
+            {
+                gvk[j] += d * s[j];
+                ws.ds[j] += d * vk[j];
+            }
+        }
+
+        // back through at most bptt_truncate earlier steps; the gradient
+        // of every z[tau] is summed over all the windows that reach it
+        ws.dc.assign(H, 0.0f);
+        int stop = max(0, t - bptt_truncate);
+        for (int tau = t; tau >= stop; tau--)
+        {
+            const float *zt = &ws.z[(size_t)tau * 4 * H];
+            const float *at = &ws.a[(size_t)tau * 4 * H];
+            const float *ct = &ws.c[(size_t)tau * H];
+            const float *cp = tau ? &ws.c[(size_t)(tau - 1) * H] : &ws.zero[0];
+            float *dz = &ws.dz[(size_t)tau * 4 * H];
+            float *step = &ws.step[0];
+            for (int r = 0; r < H; r++)
+            {
+                float tc = tanhf(ct[r]);
+                float i = at[r], f = at[H + r], o = at[2 * H + r], g = at[3 * H + r];
+                float dc = ws.dc[r] + ws.ds[r] * o * (1.0f - tc * tc);
+                step[r] = dc * g * hard_sigmoid_grad(zt[r]);
+                step[H + r] = dc * cp[r] * hard_sigmoid_grad(zt[H + r]);
+                step[2 * H + r] = ws.ds[r] * tc * hard_sigmoid_grad(zt[2 * H + r]);
+                step[3 * H + r] = dc * i * (1.0f - g * g);
+                ws.dc[r] = dc * f;
+            }
+            for (int r = 0; r < 4 * H; r++)
+                dz[r] += step[r];
+            if (tau == stop)
+                break;
+
+            // ds of s[tau-1] = sum over the gates of W[k].T.dot(dz_k)
+            fill(ws.ds.begin(), ws.ds.end(), 0.0f);
+            for (int k = 0; k < 4; k++)
+                for (int r = 0; r < H; r++)
+                {
+                    float d = step[k * H + r];
+                    if (d == 0.0f)
+                        continue;
+                    const float *w = W + k * HH + (size_t)r * H;
+                    for (int j = 0; j < H; j++)
+                        ws.ds[j] += d * w[j];
+                }
+        }
+    }
+    if (!grad)
+        return stats;
+
+    // U, W and b from the summed dz, and x_e's share for A
+    float *gU = grad + off_U;
+    float *gW = grad + off_W;
+    float *gb = grad + off_b;
+    ws.dx_e.assign((size_t)T * H, 0.0f);
+    for (int t = 0; t < T; t++)
+    {
+        const float *dz = &ws.dz[(size_t)t * 4 * H];
+        const float *x_e = &ws.x_e[(size_t)t * H];
+        const float *s_prev = t ? &ws.s[(size_t)(t - 1) * H] : &ws.zero[0];
+        float *dx_e = &ws.dx_e[(size_t)t * H];
+        for (int k = 0; k < 4; k++)
+        {
+            float *gbk = gb + (size_t)(k == 3 ? 2 : k) * H;
+            for (int r = 0; r < H; r++)
+            {
+                float d = dz[k * H + r];
+                if (d == 0.0f)
+                    continue;
+                const float *u = U + k * HH + (size_t)r * H;
+                float *gu = gU + k * HH + (size_t)r * H;
+                float *gw = gW + k * HH + (size_t)r * H;
+                gbk[r] += d;
+                for (int j = 0; j < H; j++)
+                {
+                    gu[j] += d * x_e[j];
+                    gw[j] += d * s_prev[j];
+                    dx_e[j] += d * u[j];
+                }
+            }
+        }
+    }
+
+    // A += dx_e.T.dot(X), one block of bins at a time for all frames
+    float *gA = grad + off_A;
+    for (int r = 0; r < H; r++)
+        for (int k0 = 0; k0 < I; k0 += TRAIN_KC)
+        {
+            int n = min(TRAIN_KC, I - k0);
+            float *ga = gA + (size_t)r * I + k0;
+            for (int t = 0; t < T; t++)
+            {
+                float d = ws.dx_e[(size_t)t * H + r];
+                if (d == 0.0f)
+                    continue;
+                const float *x = &song.X[(size_t)t * I + k0];
+                for (int k = 0; k < n; k++)
+                    ga[k] += d * x[k];
+            }
+        }
+
+    return stats;
+}
+
+TrainStats RNNTrainer::run(const vector<const TrainSong *> &songs, bool with_grad) const
+{
+    for (size_t n = 0; n < songs.size(); n++)
+    {
+        const TrainSong &song = *songs[n];
+        if (song.X.size() != (size_t)song.T * input_dim ||
+            song.Y.size() != (size_t)song.T * output_dim)
+            throw runtime_error("trainer: " + song.name + " does not match the model shape");
+    }
+
+    int workers = max(1, min(threads, (int)songs.size()));
+    if (with_grad)
+    {
+        grads.resize(workers);
+        for (int i = 0; i < workers; i++)
+            grads[i].assign(theta.size(), 0.0f);
+    }
+
+    vector<TrainStats> stats(workers);
+    atomic<size_t> next(0);
+    vector<thread> pool;
+    for (int i = 0; i < workers; i++)
+        pool.push_back(thread([&, i]()
+        {
+            Workspace ws;
+            float *grad = with_grad ? &grads[i][0] : NULL;
+            for (size_t n = next++; n < songs.size(); n = next++)
+            {
+                TrainStats s = song_gradient(*songs[n], grad, ws);
+                stats[i].loss += s.loss;
+                stats[i].frames += s.frames;
+                stats[i].correct += s.correct;
+            }
+        }));
+    for (size_t i = 0; i < pool.size(); i++)
+        pool[i].join();
+
+    TrainStats total;
+    for (int i = 0; i < workers; i++)
+    {
+        total.loss += stats[i].loss;
+        total.frames += stats[i].frames;
+        total.correct += stats[i].correct;
+        if (with_grad && i > 0)
+            for (size_t k = 0; k < theta.size(); k++)
+                grads[0][k] += grads[i][k];
+    }
+    return total;
+}
+
+TrainStats RNNTrainer::step(const vector<const TrainSong *> &batch)
+{
+    TrainStats stats = run(batch, true);
+    if (stats.frames == 0)
+        return stats;
+
+    // mean over the labelled frames, clipped to a norm of at most clip
+    vector<float> &g = grads[0];
+    double scale = 1.0 / stats.frames;
+    double norm = 0.0;
+    for (size_t k = 0; k < g.size(); k++)
+        norm += (double)g[k] * g[k];
+    norm = sqrt(norm) * scale;
+    if (clip > 0.0 && norm > clip)
+        scale *= clip / norm;
+
+    updates++;
+    double b1 = TRAIN_ADAM_BETA1, b2 = TRAIN_ADAM_BETA2;
+    double rate = learning_rate * sqrt(1.0 - pow(b2, (double)updates)) /
+                  (1.0 - pow(b1, (double)updates));
+    for (size_t k = 0; k < theta.size(); k++)
+    {
+        float gk = (float)(g[k] * scale);
+        m[k] = (float)(b1 * m[k] + (1.0 - b1) * gk);
+        v[k] = (float)(b2 * v[k] + (1.0 - b2) * gk * gk);
+        theta[k] -= (float)(rate * m[k] / (sqrt((double)v[k]) + TRAIN_ADAM_EPSILON));
+    }
+    return stats;
+}
+
+TrainStats RNNTrainer::evaluate(const vector<const TrainSong *> &songs) const
+{
+    return run(songs, false);
+}
+
+void RNNTrainer::store(RNN &model) const
+{
+    model.input_dim = input_dim;
+    model.hidden_dim = hidden_dim;
+    model.output_dim = output_dim;
+    model.A = SharedWeights<float>(AlignedFloats(theta.begin() + off_A, theta.begin() + off_U));
+    model.U.assign(theta.begin() + off_U, theta.begin() + off_W);
+    model.W.assign(theta.begin() + off_W, theta.begin() + off_b);
+    model.b.assign(theta.begin() + off_b, theta.begin() + off_V);
+    model.V.assign(theta.begin() + off_V, theta.begin() + off_c);
+    model.c_o.assign(theta.begin() + off_c, theta.end());
+    model.pack();
+    model.set_projection(model.projection);
+}
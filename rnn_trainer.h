@@ -0,0 +1,105 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Truncated BPTT trainer for the LSTM of rnn_LSTM_CPU.py, so the model
+// can be retrained on recordings of a new keyboard or room without the
+// Theano setup it was originally trained with.
+//
+// The loss is the cross entropy of the softmax output against the
+// one-hot labels ("out" in the song npz) of every frame. As in
+// RNN.bptt_truncate, the error of frame t is propagated back through at
+// most bptt_truncate earlier steps. The songs of a minibatch are spread
+// over the cores, every worker sums its gradients into its own buffer,
+// and the averaged gradient is clipped to a maximum norm and applied
+// with Adam.
+//
+// The trainer keeps its own float copy of the parameters; store() puts
+// them back into an RNN, whose save_param() writes the npz schema that
+// load_param() and rnn_LSTM_CPU.py read.
+
+#ifndef RNN_TRAINER_H
+#define RNN_TRAINER_H
+
+#include <string>
+#include <vector>
+
+#include "rnn_LSTM_CPU.h"
+
+#define TRAIN_BPTT_TRUNCATE     4       // RNN.bptt_truncate
+#define TRAIN_LEARNING_RATE     0.001   // learning_rate in rnn_LSTM_CPU.py
+#define TRAIN_BATCH             16      // songs per minibatch
+#define TRAIN_CLIP              5.0     // maximum gradient norm
+#define TRAIN_ADAM_BETA1        0.9
+#define TRAIN_ADAM_BETA2        0.999
+#define TRAIN_ADAM_EPSILON      1e-8
+
+// one labelled song: X is (T, input_dim), Y is (T, output_dim)
+struct TrainSong
+{
+    std::string name;
+    std::vector<float> X;
+    std::vector<float> Y;
+    int T;
+};
+
+// totals over a set of songs
+struct TrainStats
+{
+    TrainStats() : loss(0.0), frames(0), correct(0) { }
+
+    double loss;        // summed cross entropy [nats]
+    long frames;
+    long correct;       // frames whose argmax is the labelled note
+};
+
+class RNNTrainer
+{
+public:
+    // starts from the parameters of model, which must have a float A
+    RNNTrainer(const RNN &model, int bptt_truncate=TRAIN_BPTT_TRUNCATE, int threads=0);
+
+    // random parameters like RNN.__init__(): uniform in +-sqrt(1/fan in)
+    // for A, U, V and W, zero biases; resets the optimizer
+    void randomize(unsigned int seed);
+
+    // one Adam update on the gradient averaged over the frames of batch;
+    // returns the loss and accuracy before the update
+    TrainStats step(const std::vector<const TrainSong *> &batch);
+
+    // loss and accuracy without training
+    TrainStats evaluate(const std::vector<const TrainSong *> &songs) const;
+
+    // copy the parameters into model and repack it
+    void store(RNN &model) const;
+
+    double learning_rate;
+    double clip;            // 0 = no clipping
+
+protected:
+    struct Workspace;
+
+    // loss of one song; adds its gradient to grad unless grad is NULL
+    TrainStats song_gradient(const TrainSong &song, float *grad, Workspace &ws) const;
+
+    // runs song_gradient() over songs on all threads, summing the
+    // gradients into grads[0] when with_grad is set
+    TrainStats run(const std::vector<const TrainSong *> &songs, bool with_grad) const;
+
+    int input_dim;
+    int hidden_dim;
+    int output_dim;
+    int bptt_truncate;
+    int threads;
+
+    // A, U, W, b, V, c_o back to back, at these offsets
+    std::vector<float> theta;
+    size_t off_A, off_U, off_W, off_b, off_V, off_c;
+
+    // Adam moments and step count
+    std::vector<float> m, v;
+    long updates;
+
+    // one gradient buffer per worker, kept between steps
+    mutable std::vector<std::vector<float> > grads;
+};
+
+#endif
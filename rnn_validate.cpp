@@ -0,0 +1,146 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Compares an approximate inference mode against the dense float path
+// on a set of songs and reports how much it changes the output.
+//
+// usage: rnn_validate [--param file.npz] [--mode sparse|int8]
+//                     [--threshold t] [--top-k k] [song.npz ...]
+//
+// Without songs the bundled dirty_example_*.npz files are used.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "rnn_LSTM_CPU.h"
+
+using namespace std;
+
+static vector<int> argmax(const vector<float> &out, int T, int O)
+{
+    vector<int> notes(T);
+    for (int t = 0; t < T; t++)
+    {
+        int best = 0;
+        for (int k = 1; k < O; k++)
+            if (out[(size_t)t * O + k] > out[(size_t)t * O + best])
+                best = k;
+        notes[t] = best;
+    }
+    return notes;
+}
+
+int main(int argc, char *argv[])
+{
+    string param = RNN_PARAM_FILE;
+    string mode = "sparse";
+    float threshold = 0.0f;
+    int top_k = 0;
+    vector<string> songs;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--param" && i + 1 < argc)
+            param = argv[++i];
+        else if (arg == "--mode" && i + 1 < argc)
+            mode = argv[++i];
+        else if (arg == "--threshold" && i + 1 < argc)
+            threshold = (float)atof(argv[++i]);
+        else if (arg == "--top-k" && i + 1 < argc)
+            top_k = atoi(argv[++i]);
+        else
+            songs.push_back(arg);
+    }
+    if (songs.empty())
+    {
+        songs.push_back("dirty_example_B4.npz");
+        songs.push_back("dirty_example_C4.npz");
+        songs.push_back("dirty_example_G4.npz");
+        songs.push_back("dirty_example_EDC.npz");
+    }
+
+    try
+    {
+        RNN dense;
+        dense.load_param(param);
+
+        RNN approx = dense;
+        approx.sparse_threshold = threshold;
+        approx.sparse_top_k = top_k;
+        if (mode == "sparse")
+            approx.set_projection(PROJECT_SPARSE);
+        else if (mode == "int8")
+            approx.set_projection(PROJECT_INT8);
+        else
+            throw runtime_error("unknown mode " + mode);
+
+        int O = dense.output_dim;
+        size_t frames = 0, agree = 0;
+        double worst = 0.0, bins = 0.0;
+
+        for (size_t n = 0; n < songs.size(); n++)
+        {
+            vector<float> X, Y;
+            int T = get_data(songs[n], X, Y);
+
+            vector<float> out_d, out_a, s;
+            dense.forward_prop(X, T, out_d, s);
+            approx.forward_prop(X, T, out_a, s);
+
+            double err = 0.0;
+            for (size_t k = 0; k < out_d.size(); k++)
+                err = fmax(err, fabs((double)out_d[k] - out_a[k]));
+
+            vector<int> notes_d = argmax(out_d, T, O);
+            vector<int> notes_a = argmax(out_a, T, O);
+            int same = 0;
+            for (int t = 0; t < T; t++)
+                same += (notes_d[t] == notes_a[t]);
+
+            // projection work actually done, as a fraction of the dense one
+            double active = (double)T * dense.input_dim;
+            if (approx.projection == PROJECT_SPARSE)
+            {
+                active = 0.0;
+                vector<int> idx(dense.input_dim);
+                for (int t = 0; t < T; t++)
+                    active += lstm_active_bins(&X[(size_t)t * dense.input_dim], dense.input_dim,
+                                               threshold, top_k, &idx[0]);
+            }
+            double frac = T ? active / ((double)T * dense.input_dim) : 0.0;
+
+            fprintf(stdout,"%s: T=%d max|dp|=%.3g argmax agree=%d/%d projection flops=%.1f%%\n",
+                    songs[n].c_str(),T,err,same,T,100.0*frac);
+            if (same != T)
+            {
+                fprintf(stdout,"  float:");
+                for (int t = 0; t < T; t++)
+                    fprintf(stdout," %d",notes_d[t]);
+                fprintf(stdout,"\n  %s:",mode.c_str());
+                for (int t = 0; t < T; t++)
+                    fprintf(stdout," %d",notes_a[t]);
+                fprintf(stdout,"\n");
+            }
+
+            frames += T;
+            agree += same;
+            worst = fmax(worst, err);
+            bins += active;
+        }
+
+        fprintf(stdout,"total: max|dp|=%.3g argmax agree=%.1f%% projection flops=%.1f%%\n",
+                worst, frames ? 100.0*agree/frames : 100.0,
+                frames ? 100.0*bins/((double)frames*dense.input_dim) : 0.0);
+    }
+    catch (const exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
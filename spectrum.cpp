@@ -0,0 +1,109 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// WAV to spectral frames, see spectrum.h.
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "spectrum.h"
+
+using namespace std;
+
+SpectrumStream::SpectrumStream(const string &filename, const SpectrumConfig &config) :
+    wav(filename), config(config), nframes(0), produced(0),
+    fft((size_t)llround(wav.sample_rate() / SPECTRUM_RESOLUTION), config.bins), filled(0)
+{
+    size_t n = fft.size();
+    window_len = (size_t)llround(config.window * wav.sample_rate());
+    hop_len = (size_t)llround(config.hop * wav.sample_rate());
+    if (window_len == 0 || window_len > n)
+        throw runtime_error("spectrum: window must be between one sample and 1/resolution seconds");
+    if (hop_len == 0)
+        throw runtime_error("spectrum: hop must be at least one sample");
+    if (config.bins < 1 || fft.bins() != (size_t)config.bins)
+        throw runtime_error(filename + ": sample rate too low for the requested bins");
+
+    size_t total = wav.frames();
+    if (total > 0)
+        nframes = (total <= window_len) ? 1 : (int)((total - window_len) / hop_len + 1);
+
+    taper.assign(window_len, 1.0);
+    if (config.shape == WINDOW_HANN && window_len > 1)
+    {
+        double sum = 0.0;
+        for (size_t j = 0; j < window_len; j++)
+        {
+            taper[j] = 0.5 - 0.5 * cos(2.0 * M_PI * (double)j / (double)(window_len - 1));
+            sum += taper[j];
+        }
+        for (size_t j = 0; j < window_len; j++)
+            taper[j] *= window_len / sum;
+    }
+
+    samples.resize(window_len);
+    padded.assign(n, 0.0);
+    spectrum.resize(fft.bins());
+}
+
+bool SpectrumStream::next(double *frame)
+{
+    if (produced >= nframes)
+        return false;
+
+    while (filled < window_len)
+    {
+        size_t got = wav.read(&samples[filled], window_len - filled);
+        if (got == 0)
+            break;
+        filled += got;
+    }
+
+    // the tail of padded stays zero from the constructor
+    for (size_t j = 0; j < filled; j++)
+        padded[j] = samples[j] * taper[j];
+    for (size_t j = filled; j < window_len; j++)
+        padded[j] = 0.0;
+
+    fft.transform(&padded[0], &spectrum[0]);
+    for (int k = 0; k < config.bins; k++)
+        frame[k] = log10(max(abs(spectrum[k]), SPECTRUM_FLOOR));
+
+    // slide to the next frame start, only ever holding one window
+    if (hop_len < window_len)
+    {
+        size_t keep = filled > hop_len ? filled - hop_len : 0;
+        if (keep)
+            memmove(&samples[0], &samples[hop_len], keep * sizeof(double));
+        filled = keep;
+    }
+    else
+    {
+        size_t skip = hop_len - window_len;
+        filled = 0;
+        while (skip > 0)
+        {
+            size_t got = wav.read(&samples[0], min(skip, window_len));
+            if (got == 0)
+                break;
+            skip -= got;
+        }
+    }
+
+    produced++;
+    return true;
+}
+
+int wav_spectrum(const string &filename, vector<float> &X, const SpectrumConfig &config)
+{
+    SpectrumStream stream(filename, config);
+    int T = stream.frames();
+    X.resize((size_t)T * config.bins);
+
+    vector<double> frame(config.bins);
+    for (int t = 0; t < T && stream.next(&frame[0]); t++)
+        for (int k = 0; k < config.bins; k++)
+            X[(size_t)t * config.bins + k] = (float)frame[k];
+    return T;
+}
@@ -0,0 +1,78 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Spectral front-end: turns a WAV file into the frames the LSTM reads,
+// i.e. the rows of the "data" array in the dirty_example_*.npz files.
+//
+// Every frame is log10 |rfft| of sample_rate / SPECTRUM_RESOLUTION
+// samples (10 s, so bin k sits at 0.1 * k Hz) on the 16 bit sample
+// scale, truncated to the first SPECTRUM_BINS bins (0 - 2 kHz). The
+// analysis window may be shorter than that, it is zero padded to keep
+// the 0.1 Hz grid. Frames start every hop seconds; a file shorter than
+// one window still gives one zero padded frame.
+//
+// The file is streamed: memory is one window of samples plus the FFT
+// work space, however long the recording is.
+
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include <string>
+#include <vector>
+
+#include "fft.h"
+#include "wav.h"
+
+#define SPECTRUM_RESOLUTION 0.1     // [Hz] per bin
+#define SPECTRUM_BINS       20000
+#define SPECTRUM_FLOOR      1e-10   // magnitude floor before the log
+
+enum SpectrumWindow
+{
+    WINDOW_RECT,    // what the bundled spectra use
+    WINDOW_HANN     // scaled to unit mean, so tone levels stay comparable
+};
+
+struct SpectrumConfig
+{
+    SpectrumConfig() : window(10.0), hop(10.0), shape(WINDOW_RECT), bins(SPECTRUM_BINS) { }
+
+    double window;          // [s] analysis window, at most 1 / SPECTRUM_RESOLUTION
+    double hop;             // [s] between frame starts
+    SpectrumWindow shape;
+    int bins;
+};
+
+class SpectrumStream
+{
+public:
+    SpectrumStream(const std::string &filename, const SpectrumConfig &config = SpectrumConfig());
+
+    int sample_rate() const { return wav.sample_rate(); }
+    int bins() const { return config.bins; }
+
+    // number of frames the whole file yields
+    int frames() const { return nframes; }
+
+    // compute the next frame into frame[0 .. bins()), false at the end
+    bool next(double *frame);
+
+protected:
+    WavReader wav;
+    SpectrumConfig config;
+    size_t window_len;
+    size_t hop_len;
+    int nframes;
+    int produced;
+    RealFFT fft;
+    std::vector<double> taper;
+    std::vector<double> samples;    // current window, filled from the front
+    size_t filled;
+    std::vector<double> padded;     // windowed samples on the FFT length
+    std::vector<cplx> spectrum;
+};
+
+// whole file at once, X is (frames, bins) row major like get_data
+int wav_spectrum(const std::string &filename, std::vector<float> &X,
+                 const SpectrumConfig &config = SpectrumConfig());
+
+#endif
@@ -7,16 +7,25 @@
 
 //NOTE FLIPPED Y AND X! Y = HORIZONTAL X = VERTICAL
 
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
 #include <cmath>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
 #include <stdio.h>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <yarp/os/Network.h>
 #include <yarp/os/RFModule.h>
 #include <yarp/os/RateThread.h>
+#include <yarp/os/RpcServer.h>
 #include <yarp/os/Time.h>
 #include <yarp/sig/Vector.h>
 #include <yarp/math/Math.h>
@@ -29,9 +38,26 @@
 #include <iCub/iKin/iKinFwd.h>
 #include <iCub/iKin/iKinIpOpt.h>
 
+#include "note_decoder.h"
+#include "note_stream.h"
+#include "rnn_LSTM_CPU.h"
+#include "rnn_client.h"
+#include "spectrum.h"
+
 #define CTRL_THREAD_PER     0.02    // [s]
 #define PRINT_STATUS_PER    1.0     // [s]
 #define MAX_TORSO_PITCH     30.0    // [deg]
+#define MOTION_POLL_PER     0.005   // [s]
+#define MOTION_TIMEOUT      2.0     // [s] allowed beyond the expected move time
+#define PLAYBACK_TEMPO      60.0    // [frames/min] of the decoded onsets
+#define CART_TRAJ_TIME      1.0     // [s]
+#define STROKE_OVERLAP      0.3     // share of a hover/lift move blended into the next
+#define JOINT_REF_SPEED     10.0    // [deg/s]
+#define KEYSTROKE_FILE      "keystrokes.ini"
+#define KEYSTROKE_MAX_NOTES 128
+#define IK_CACHE_FILE       "ik_cache.ini"
+#define IK_CACHE_TOLERANCE  0.001   // [m] or [rad] the calibration may move
+#define IK_ARM_JOINTS       7
 
 using namespace std;
 using namespace yarp::os;
@@ -41,6 +67,97 @@ using namespace yarp::math;
 using namespace iCub::iKin;
 
 Vector next_note;
+// probability of every note in next_note, 1.0 when the backend has none
+Vector note_confidence;
+// first frame of every note in next_note, the timing of PLAYBACK_AUTO
+Vector note_onset;
+// guards next_note while the streaming backend is still appending to it
+std::mutex note_mutex;
+bool song_done = true;
+
+// "motion-done" event of the Cartesian controller: arm() before sending
+// a target, wait() then returns as soon as the controller reports the
+// motion finished instead of polling for it
+class MotionDoneEvent: public CartesianEvent
+{
+protected:
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool fired;
+
+    virtual void cartesianEventCallback()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        fired=true;
+        cv.notify_all();
+    }
+
+public:
+    MotionDoneEvent() : fired(false)
+    {
+        cartesianEventParameters.type="motion-done";
+    }
+
+    void arm()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        fired=false;
+    }
+
+    // false if the event did not come within timeout seconds
+    bool wait(double timeout)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        return cv.wait_for(lock,std::chrono::duration<double>(timeout),
+                           [this]() { return fired; });
+    }
+};
+
+// how run() paces the strokes
+enum Playback
+{
+    PLAYBACK_INTERACTIVE,   // wait for a key on stdin after every stroke
+    PLAYBACK_AUTO,          // play every note at its onset, scaled by the tempo
+    PLAYBACK_STEP           // one stroke per "step" on the control port
+};
+
+// the three strokes of a note
+enum Stroke
+{
+    STROKE_HOVER,
+    STROKE_PRESS,
+    STROKE_LIFT,
+    STROKE_COUNT
+};
+
+// the two Cartesian poses of a key; lifting goes back to IK_HOVER
+enum KeyPose
+{
+    IK_HOVER,
+    IK_PRESS,
+    IK_POSES
+};
+
+// joint positions of the right arm for every (note, stroke), read from
+// KEYSTROKE_FILE so keys can be added or retuned without a recompile
+struct KeystrokeTable
+{
+    KeystrokeTable() : notes(0), joints(0) { }
+
+    double *at(int note, int phase)
+    {
+        return &q[((size_t)note*STROKE_COUNT+phase)*joints];
+    }
+
+    const double *at(int note, int phase) const
+    {
+        return &q[((size_t)note*STROKE_COUNT+phase)*joints];
+    }
+
+    int notes;
+    int joints;
+    std::vector<double> q;      // [note][stroke][joint] [deg]
+};
 
 class CtrlThread: public RateThread,
                   public CartesianEvent
@@ -51,6 +168,9 @@ protected:
 
     PolyDriver positionRight;
     IPositionControl *posRight;
+    IControlLimits *limRight;
+    IControlMode2 *modeRight;
+    IEncoders *encRight;
 
     PolyDriver positionLeft;
     IPositionControl *posLeft;
@@ -70,6 +190,20 @@ protected:
 
     Vector command;
 
+    // keystrokes of run_mode 1; keys is swapped whole by loadKeystrokes()
+    std::string keystroke_file;
+    Vector joint_min, joint_max;
+    std::shared_ptr<const KeystrokeTable> keys;
+    std::mutex keys_mutex;
+
+    // arm joints [deg] the Cartesian solver found for every key pose,
+    // [note][KeyPose][joint], kept in ik_cache_file for the calibration
+    // (home pose, table and key positions) they were solved for
+    std::string ik_cache_file;
+    Vector ik_calibration;
+    Vector ik_q;
+    std::vector<bool> ik_known;
+
     int startup_context_id;
     int run_mode;
 
@@ -85,7 +219,35 @@ protected:
     double black_white_x;
 
     char ack;
-    int index;
+    // strokes whose note is less certain than this are skipped
+    double min_confidence;
+
+    // motion completion: poll period, margin on top of the time a move
+    // should take before it counts as failed and whether the Cartesian
+    // moves wait for the "motion-done" event rather than polling
+    double motion_poll;
+    double motion_timeout;
+    bool motion_event;
+    MotionDoneEvent motion_done;
+
+    // playback state; the atomics are shared with the control port
+    std::atomic<int> playback;
+    std::atomic<double> tempo;      // [frames/min]
+    std::atomic<bool> paused;
+    std::atomic<int> steps;         // strokes left to do in PLAYBACK_STEP
+    std::atomic<bool> reanchor;     // restart the timing from the next note
+    std::atomic<int> index;         // note of next_note being played
+    std::atomic<int> phase;         // next stroke of the current note
+    int note;
+    double stroke[STROKE_COUNT];    // completion time of every stroke [s]
+    double late;                    // how late the note started [s]
+    // the next target goes out once a hover or lift joint move is this
+    // far along (0 = wait for every move to stop), so the lift blends
+    // into the travel to the next key and the press into the hover
+    double traj_time;
+    double stroke_overlap;
+    double anchor_time;             // when the note at anchor_onset started
+    double anchor_onset;
 
     //to fill in later on physical robot?
     double robotOffset;
@@ -98,12 +260,55 @@ protected:
     }
 
 public:
-    CtrlThread(const double period) : RateThread(int(period*1000.0))
+    // options, all optional:
+    //   --min_confidence p     skip strokes the network is unsure about
+    //   --motion_poll s        poll period while waiting for a move
+    //   --motion_timeout s     give up on a move this long after it should have
+    //                          ended, then playback pauses
+    //   --motion_wait event    Cartesian moves wait for "motion-done"
+    //   --playback interactive|auto|step
+    //   --tempo f              decoded frames per minute in auto playback
+    //   --run_mode 0|1         Cartesian or joint strokes, asked if missing
+    //   --keystrokes file      joint table of run_mode 1
+    //   --ik_cache file        joint solutions of the run_mode 0 key poses
+    //   --traj_time s          duration of a Cartesian move
+    //   --stroke_overlap f     share of a hover or lift blended into the next
+    CtrlThread(const double period, ResourceFinder &rf) :
+        RateThread(int(period*1000.0))
     {
         // we wanna raise an event each time the arm is at 20%
         // of the trajectory (or 80% far from the target)
         cartesianEventParameters.type="motion-ongoing";
         cartesianEventParameters.motionOngoingCheckPoint=0.2;
+
+        min_confidence=rf.check("min_confidence",Value(0.0)).asDouble();
+        motion_poll=rf.check("motion_poll",Value(MOTION_POLL_PER)).asDouble();
+        motion_timeout=rf.check("motion_timeout",Value(MOTION_TIMEOUT)).asDouble();
+        motion_event=rf.check("motion_wait",Value("poll")).asString()=="event";
+
+        std::string mode=rf.check("playback",Value("interactive")).asString();
+        playback=(mode=="auto") ? PLAYBACK_AUTO :
+                 (mode=="step") ? PLAYBACK_STEP : PLAYBACK_INTERACTIVE;
+        tempo=rf.check("tempo",Value(PLAYBACK_TEMPO)).asDouble();
+        if (!(tempo > 0.0))
+        {
+            fprintf(stdout,"Tempo must be above 0, using %g\n",PLAYBACK_TEMPO);
+            tempo=PLAYBACK_TEMPO;
+        }
+        run_mode=rf.check("run_mode") ? rf.find("run_mode").asInt() : -1;
+        keystroke_file=rf.check("keystrokes",Value(KEYSTROKE_FILE)).asString();
+        std::string found=rf.findFile(keystroke_file);
+        if (!found.empty())
+            keystroke_file=found;
+        ik_cache_file=rf.check("ik_cache",Value(IK_CACHE_FILE)).asString();
+        traj_time=rf.check("traj_time",Value(CART_TRAJ_TIME)).asDouble();
+        stroke_overlap=rf.check("stroke_overlap",Value(STROKE_OVERLAP)).asDouble();
+        stroke_overlap=std::max(0.0,std::min(stroke_overlap,0.9));
+        paused=false;
+        steps=0;
+        reanchor=true;
+        index=0;
+        phase=STROKE_HOVER;
     }
 
     virtual bool threadInit()
@@ -146,6 +351,9 @@ public:
         bool ok;
         ok = positionRight.view(posRight);
         ok = ok && positionRight.view(moveEncs);
+        ok = ok && positionRight.view(limRight);
+        ok = ok && positionRight.view(modeRight);
+        ok = ok && positionRight.view(encRight);
 
         if (!ok) {
             printf("Problems acquiring interfaces\n");
@@ -163,6 +371,20 @@ public:
         encoders.resize(nj);
         tmp.resize(nj);
         command.resize(nj);
+        joint_min.resize(nj);
+        joint_max.resize(nj);
+        for (int j = 0; j < nj; j++)
+            limRight->getLimits(j, &joint_min[j], &joint_max[j]);
+
+        try
+        {
+            loadKeystrokes();
+        }
+        catch (const std::exception &e)
+        {
+            fprintf(stdout,"%s\n",e.what());
+            return false;
+        }
         
         int i;
         for (i = 0; i < nj; i++) {
@@ -171,7 +393,7 @@ public:
         posRight->setRefAccelerations(tmp.data());
 
         for (i = 0; i < nj; i++) {
-            tmp[i] = 10.0;
+            tmp[i] = JOINT_REF_SPEED;
             posRight->setRefSpeed(i, tmp[i]);
         }
 
@@ -208,14 +430,11 @@ public:
         command[13]=48;
         command[14]=0;
         command[15]=14;
-        posRight->positionMove(command.data());
-        
-        bool done=false;
-
-        while(!done)
+        if (!posRight->positionMove(command.data()) ||
+            waitMotion(posRight,moveTime(encoders,command)) < 0.0)
         {
-            posRight->checkMotionDone(&done);
-            Time::delay(0.1);
+            posRight->stop();
+            return false;
         }
 
         //positionRight.close();
@@ -262,7 +481,7 @@ public:
         posLeft->setRefAccelerations(tmp2.data());
 
         for (i = 0; i < nj2; i++) {
-            tmp2[i] = 10.0;
+            tmp2[i] = JOINT_REF_SPEED;
             posLeft->setRefSpeed(i, tmp2[i]);
         }
 
@@ -299,14 +518,11 @@ public:
         command[13]=7;
         command[14]=3;
         command[15]=0;
-        posLeft->positionMove(command.data());
-        
-        done=false;
-
-        while(!done)
+        if (!posLeft->positionMove(command.data()) ||
+            waitMotion(posLeft,moveTime(encoders2,command)) < 0.0)
         {
-            posLeft->checkMotionDone(&done);
-            Time::delay(0.1);
+            posLeft->stop();
+            return false;
         }
 
         //back to finger down
@@ -329,7 +545,7 @@ public:
         icart->storeContext(&startup_context_id);
 
         // set trajectory time
-        icart->setTrajTime(1.0);
+        icart->setTrajTime(traj_time);
 
         // get the torso dofs
         Vector newDof, curDof;
@@ -348,10 +564,6 @@ public:
         icart->getDOF(curDof);
         fprintf(stdout,"curDof = %s\n",curDof.toString().c_str());  
 
-        Vector xdhat, odhat, armPos;
-        icart->askForPose(xd,od, xdhat, odhat, armPos);
-        fprintf(stdout,"armPos = %s\n",armPos.toString().c_str());
-
         // print out some info about the controller
         Bottle info;
         icart->getInfo(info);
@@ -359,6 +571,8 @@ public:
 
         // register the event, attaching the callback
         icart->registerEvent(*this);
+        if (motion_event)
+            icart->registerEvent(motion_done);
 
         iCubFinger finger("right_middle");
         int nEncs;
@@ -459,11 +673,15 @@ public:
         x_notes[11]=home[0];
         y_notes[11]=y_notes[10] + small_white_black_y;
 
+        loadIKCache();
         index = 0;
 
-        cout << "Run runmode 0(Cartesian) or 1(Motor)?" << endl;
-        cin >> ack;
-        run_mode = ack - '0';
+        if (run_mode < 0)
+        {
+            cout << "Run runmode 0(Cartesian) or 1(Motor)?" << endl;
+            cin >> ack;
+            run_mode = ack - '0';
+        }
         return true;
     }
 
@@ -479,94 +697,482 @@ public:
 
     virtual void run()
     {
-        Vector xdhat,odhat,armPos;
-        Vector test;
-        test.resize(next_note.size());
-        test = next_note;
+        if (paused)
+            return;
 
-        t=Time::now();
+        if (phase == STROKE_HOVER)
+        {
+            double confidence, onset;
+            {
+                std::lock_guard<std::mutex> lock(note_mutex);
+                if (index >= next_note.size())
+                {
+                    // the stream has not classified the next frame yet
+                    if (!song_done || next_note.size() == 0)
+                        return;
+                    index = 0;
+                    reanchor = true;
+                }
+                note = (int)next_note[index];
+                confidence = note_confidence[index];
+                onset = note_onset[index];
+            }
 
-        if(run_mode == 0)
+            if (confidence < min_confidence)
+            {
+                fprintf(stdout,"Skipping note %d, confidence %g < %g\n",
+                        note,confidence,min_confidence);
+                index++;
+                return;
+            }
+
+            // the first note after a start, pause or tempo change sets
+            // the clock, the others are due relative to it
+            t=Time::now();
+            if (reanchor.exchange(false))
+            {
+                anchor_time=t;
+                anchor_onset=onset;
+            }
+            double due=anchor_time+(onset-anchor_onset)*60.0/tempo;
+            if (playback == PLAYBACK_AUTO && t < due)
+                return;
+            late=t-due;
+        }
+
+        if (playback == PLAYBACK_STEP)
         {
-            generateTarget(test[index]);
+            if (steps <= 0)
+                return;
+            steps--;
+        }
 
-            // go to the target 
-            cout << "Going to this note: " << test[index] << endl;
-            icart->goToPoseSync(xd,od);
-            icart->waitMotionDone(0.04);
-            icart->askForPose(xd,od, xdhat, odhat, armPos);
-            fprintf(stdout,"armPos = %s\n",armPos.toString().c_str());
+        if (phase == STROKE_HOVER)
+            cout << "Going to this note: " << note << endl;
+        stroke[phase]=strike(note,phase);
+        if (stroke[phase] < 0.0)
+        {
+            // the arm is not where the next stroke starts from: hold it
+            // there, "resume" on the control port tries this stroke again
+            icart->stopControl();
+            posRight->stop();
+            setPaused(true);
+            fprintf(stdout,"Stroke %d of note %d failed, paused\n",(int)phase,note);
+            return;
+        }
+        if (playback == PLAYBACK_INTERACTIVE)
+        {
             cout << "Continue?" << endl;
             cin >> ack;
+        }
+        if (++phase < STROKE_COUNT)
+            return;
+
+        fprintf(stdout,"Note %d strokes: %.0f / %.0f / %.0f ms (cycle %.0f ms), started %.0f ms late\n",
+                note,1000.0*stroke[STROKE_HOVER],1000.0*stroke[STROKE_PRESS],
+                1000.0*stroke[STROKE_LIFT],
+                1000.0*(stroke[STROKE_HOVER]+stroke[STROKE_PRESS]+stroke[STROKE_LIFT]),
+                1000.0*late);
+        phase = STROKE_HOVER;
+        index++;
 
-            //go down
-            xd[2] = tableHeight;
-            icart->goToPoseSync(xd,od);
-            icart->waitMotionDone(0.04);
-            icart->askForPose(xd,od, xdhat, odhat, armPos);
-            fprintf(stdout,"armPos = %s\n",armPos.toString().c_str());
-            cout << "Continue?" << endl;
-            cin >> ack;
+        // some verbosity
+        //printStatus();
+    }
 
-            //back up
-            xd[2] = home[2];
-            icart->goToPoseSync(xd,od);
-            icart->waitMotionDone(0.04);
-            icart->askForPose(xd,od, xdhat, odhat, armPos);
-            fprintf(stdout,"armPos = %s\n",armPos.toString().c_str());
-            cout << "Continue?" << endl;
-            cin >> ack;
+    // one stroke of note: hover over the key, press it or lift off it;
+    // returns the completion time of the move [s], negative when it did
+    // not end in time. In run_mode 0 only hover and lift to a key pose
+    // already in the IK cache return early by stroke_overlap: those are
+    // joint moves, so the blend follows a joint-space path rather than a
+    // Cartesian curve. A pose still to be solved goes through the
+    // Cartesian controller to the end, and the press always lands.
+    double strike(int note, int phase)
+    {
+        if (run_mode == 0)
+        {
+            // the network may know more notes than the keyboard has keys
+            if (note < 0 || note >= (int)x_notes.size())
+            {
+                fprintf(stdout,"No key position for note %d\n",note);
+                return 0.0;
+            }
+
+            double blend=(phase == STROKE_PRESS) ? 0.0 : stroke_overlap;
+            int slot=note*IK_POSES+((phase == STROKE_PRESS) ? IK_PRESS : IK_HOVER);
+            if (ik_known[slot])
+            {
+                // the Cartesian controller keeps tracking its last target
+                // unless stopped, and leaves the joints in its own mode;
+                // the move takes as long as its largest joint step from
+                // where the arm stopped
+                Vector from;
+                if (!icart->stopControl() || !rightArm(from))
+                {
+                    fprintf(stdout,"Cannot move the right arm to note %d\n",note);
+                    return -1.0;
+                }
+                command=from;
+                for (int j=0; j<IK_ARM_JOINTS; j++)
+                    command[j]=ik_q[slot*IK_ARM_JOINTS+j];
+                double duration=moveTime(from,command);
+                if (!positionMode() ||
+                    !posRight->positionMove(command.data()))
+                {
+                    fprintf(stdout,"Cannot move the right arm to note %d\n",note);
+                    return -1.0;
+                }
+                return waitMotion(posRight,duration,(blend > 0.0) ? (1.0-blend)*duration : 0.0);
+            }
+
+            // not solved yet: let the Cartesian controller get all the way
+            // there, without blending, and keep the joints it settled on
+            generateTarget(note);
+            if (phase == STROKE_PRESS)
+                xd[2] = tableHeight;
+
+            // a joint move still blending out would fight the controller
+            motion_done.arm();
+            if (!posRight->stop() || !icart->goToPose(xd,od))
+            {
+                fprintf(stdout,"Cannot send the pose of note %d\n",note);
+                return -1.0;
+            }
+            double done=waitCartesian();
+            Vector xdhat,odhat,qdhat;
+            if (done >= 0.0 && icart->getDesired(xdhat,odhat,qdhat) &&
+                qdhat.size() >= IK_ARM_JOINTS)
+            {
+                size_t first=qdhat.size()-IK_ARM_JOINTS;
+                for (int j=0; j<IK_ARM_JOINTS; j++)
+                    ik_q[slot*IK_ARM_JOINTS+j]=qdhat[first+j];
+                ik_known[slot]=true;
+                saveIKCache();
+            }
+            return done;
         }
-        else
+
+        Vector from;
+        if (!rightArm(from))
         {
-            generateTarget(test[index], "up");
-            cout << "Going to this note: " << test[index] << endl;
-            cin >> ack;
+            fprintf(stdout,"Cannot move the right arm to note %d\n",note);
+            return -1.0;
+        }
+        command=from;
+        if (!generateTarget(note, phase))
+        {
+            fprintf(stdout,"No keystroke for note %d in %s\n",note,keystroke_file.c_str());
+            return 0.0;
+        }
+        if (!positionMode() || !posRight->positionMove(command.data()))
+        {
+            fprintf(stdout,"Cannot move the right arm to note %d\n",note);
+            return -1.0;
+        }
+        return waitMotion(posRight,moveTime(from,command));
+    }
 
-            posRight->positionMove(command.data());
-            
-            bool done=false;
+    // the joints of the right arm as the encoders read them; the joints
+    // not in a stroke target are commanded to stay there
+    bool rightArm(Vector &q)
+    {
+        int nj=0;
+        if (!encRight->getAxes(&nj))
+            return false;
+        q.resize(nj);
+        return encRight->getEncoders(q.data());
+    }
 
-            while(!done)
+    // puts every joint of the right arm back in position control, which
+    // positionMove needs; false if the board refused
+    bool positionMode()
+    {
+        std::vector<int> modes(command.size());
+        if (!modeRight->getControlModes(modes.data()))
+            return false;
+        bool change=false;
+        for (size_t j=0; j<modes.size(); j++)
+            if (modes[j] != VOCAB_CM_POSITION)
             {
-                posRight->checkMotionDone(&done);
-                Time::delay(0.1);
+                modes[j]=VOCAB_CM_POSITION;
+                change=true;
             }
-            cout << "Continue?" << endl;
-            cin >> ack;
+        return !change || modeRight->setControlModes(modes.data());
+    }
+
+    // what the key poses are computed from
+    Vector calibration()
+    {
+        Vector c;
+        for (size_t k=0; k<home_od.size(); k++)
+            c.push_back(home_od[k]);
+        c.push_back(home[2]);
+        c.push_back(tableHeight);
+        for (size_t i=0; i<x_notes.size(); i++)
+        {
+            c.push_back(x_notes[i]);
+            c.push_back(y_notes[i]);
+        }
+        return c;
+    }
 
-            generateTarget(test[index], "down");
-            posRight->positionMove(command.data());
-            
-            done=false;
+    // takes the solutions in ik_cache_file when they were solved for the
+    // current calibration, otherwise every key pose is solved again
+    void loadIKCache()
+    {
+        static const char *pose_name[IK_POSES]={"hover","press"};
+        int notes=(int)x_notes.size();
+        ik_calibration=calibration();
+        ik_q.resize(notes*IK_POSES*IK_ARM_JOINTS);
+        ik_known.assign(notes*IK_POSES,false);
+
+        Property cache;
+        if (!cache.fromConfigFile(ik_cache_file))
+            return;
+        Bottle &group=cache.findGroup("ik_cache");
+        Bottle *key=group.find("calibration").asList();
+        bool same=(key != NULL && key->size() == (int)ik_calibration.size());
+        for (int k=0; same && k<key->size(); k++)
+            same=fabs(key->get(k).asDouble()-ik_calibration[k]) <= IK_CACHE_TOLERANCE;
+        if (!same)
+        {
+            fprintf(stdout,"%s is for another calibration, solving the keys again\n",
+                    ik_cache_file.c_str());
+            return;
+        }
+        for (int k=0; k<key->size(); k++)
+            ik_calibration[k]=key->get(k).asDouble();
 
-            while(!done)
+        int loaded=0;
+        for (int k=1; k<group.size(); k++)
+        {
+            Bottle *line=group.get(k).asList();
+            if (line == NULL || line->get(0).asString() != "note")
+                continue;
+            int i=line->get(1).asInt();
+            for (int pose=0; pose<IK_POSES; pose++)
             {
-                posRight->checkMotionDone(&done);
-                Time::delay(0.1);
+                Bottle *q=line->find(pose_name[pose]).asList();
+                if (i < 0 || i >= notes || q == NULL || q->size() != IK_ARM_JOINTS)
+                    continue;
+                int slot=i*IK_POSES+pose;
+                for (int j=0; j<IK_ARM_JOINTS; j++)
+                    ik_q[slot*IK_ARM_JOINTS+j]=q->get(j).asDouble();
+                ik_known[slot]=true;
+                loaded++;
             }
-            cout << "Continue?" << endl;
-            cin >> ack;
+        }
+        fprintf(stdout,"Loaded %d key poses from %s\n",loaded,ik_cache_file.c_str());
+    }
 
-            generateTarget(test[index], "up");
-            posRight->positionMove(command.data());
-            
-            done=false;
+    void saveIKCache()
+    {
+        static const char *pose_name[IK_POSES]={"hover","press"};
+        FILE *f=fopen(ik_cache_file.c_str(),"w");
+        if (f == NULL)
+        {
+            fprintf(stdout,"Cannot write %s\n",ik_cache_file.c_str());
+            return;
+        }
 
-            while(!done)
+        fprintf(f,"// arm joints [deg] of the Cartesian key poses, written by\n"
+                  "// tutorial_cartesian_interface; delete it to solve them again\n\n"
+                  "[ik_cache]\ncalibration (");
+        for (size_t k=0; k<ik_calibration.size(); k++)
+            fprintf(f,"%s%.6f",k ? " " : "",ik_calibration[k]);
+        fprintf(f,")\n");
+        for (int i=0; i<(int)x_notes.size(); i++)
+        {
+            if (!ik_known[i*IK_POSES+IK_HOVER] && !ik_known[i*IK_POSES+IK_PRESS])
+                continue;
+            fprintf(f,"note %d",i);
+            for (int pose=0; pose<IK_POSES; pose++)
             {
-                posRight->checkMotionDone(&done);
-                Time::delay(0.1);
+                int slot=i*IK_POSES+pose;
+                if (!ik_known[slot])
+                    continue;
+                fprintf(f," %s (",pose_name[pose]);
+                for (int j=0; j<IK_ARM_JOINTS; j++)
+                    fprintf(f,"%s%.4f",j ? " " : "",ik_q[slot*IK_ARM_JOINTS+j]);
+                fprintf(f,")");
             }
-            cout << "Continue?" << endl;
-            cin >> ack;
+            fprintf(f,"\n");
         }
-        index++;
-        if(index >= next_note.size())
-            index = 0;
+        fclose(f);
+    }
 
-        // some verbosity
-        //printStatus();
+    // reads keystroke_file and checks every joint against the limits of
+    // the arm; on any error it throws std::runtime_error and the table in
+    // use is kept
+    void loadKeystrokes()
+    {
+        static const char *stroke_name[STROKE_COUNT]={"hover","press","lift"};
+        char buf[256];
+
+        Property config;
+        if (!config.fromConfigFile(keystroke_file))
+            throw std::runtime_error("cannot read keystrokes from "+keystroke_file);
+        Bottle &group=config.findGroup("keystrokes");
+        if (group.isNull())
+            throw std::runtime_error(keystroke_file+": no [keystrokes] group");
+
+        std::shared_ptr<KeystrokeTable> table(new KeystrokeTable);
+        table->joints=group.check("joints",Value(7)).asInt();
+        if (table->joints < 1 || table->joints > (int)command.size())
+        {
+            snprintf(buf,sizeof(buf),"%s: joints must be 1 to %d",keystroke_file.c_str(),
+                     (int)command.size());
+            throw std::runtime_error(buf);
+        }
+
+        std::vector<bool> found;
+        for (int k=1; k<group.size(); k++)
+        {
+            Bottle *line=group.get(k).asList();
+            if (line == NULL || line->get(0).asString() != "note")
+                continue;
+
+            int i=line->get(1).asInt();
+            if (i < 0 || i >= KEYSTROKE_MAX_NOTES)
+            {
+                snprintf(buf,sizeof(buf),"%s: note %d out of range",keystroke_file.c_str(),i);
+                throw std::runtime_error(buf);
+            }
+            if (i >= table->notes)
+            {
+                table->notes=i+1;
+                table->q.resize((size_t)table->notes*STROKE_COUNT*table->joints);
+                found.resize(table->notes,false);
+            }
+
+            for (int phase=0; phase<STROKE_COUNT; phase++)
+            {
+                // lifting off a key goes back above it unless told otherwise
+                const char *name=(phase == STROKE_LIFT && !line->check("lift")) ?
+                                 "hover" : stroke_name[phase];
+                Bottle *q=line->find(name).asList();
+                if (q == NULL || q->size() != table->joints)
+                {
+                    snprintf(buf,sizeof(buf),"%s: note %d needs %s with %d joints",
+                             keystroke_file.c_str(),i,name,table->joints);
+                    throw std::runtime_error(buf);
+                }
+
+                double *dst=table->at(i,phase);
+                for (int j=0; j<table->joints; j++)
+                {
+                    dst[j]=q->get(j).asDouble();
+                    if (dst[j] < joint_min[j] || dst[j] > joint_max[j])
+                    {
+                        snprintf(buf,sizeof(buf),"%s: note %d %s: joint %d = %g outside [%g, %g]",
+                                 keystroke_file.c_str(),i,name,j,dst[j],joint_min[j],joint_max[j]);
+                        throw std::runtime_error(buf);
+                    }
+                }
+            }
+            found[i]=true;
+        }
+
+        if (table->notes == 0)
+            throw std::runtime_error(keystroke_file+": no notes");
+        for (int i=0; i<table->notes; i++)
+            if (!found[i])
+            {
+                snprintf(buf,sizeof(buf),"%s: note %d is missing",keystroke_file.c_str(),i);
+                throw std::runtime_error(buf);
+            }
+
+        fprintf(stdout,"Loaded %d keystrokes from %s\n",table->notes,keystroke_file.c_str());
+        std::lock_guard<std::mutex> lock(keys_mutex);
+        keys=table;
+    }
+
+    // commands of the control port, safe to call while run() is playing
+    void setPaused(bool p)
+    {
+        paused=p;
+        reanchor=true;
+    }
+
+    void addSteps(int n)
+    {
+        steps+=n;
+    }
+
+    void setPlayback(int mode)
+    {
+        playback=mode;
+        reanchor=true;
+    }
+
+    void setTempo(double frames_per_min)
+    {
+        tempo=frames_per_min;
+        reanchor=true;
+    }
+
+    std::string status()
+    {
+        const char *modes[]={"interactive","auto","step"};
+        char buf[128];
+        snprintf(buf,sizeof(buf),"%s%s tempo %g note %d stroke %d",
+                 modes[playback],paused ? " paused" : "",(double)tempo,(int)index,(int)phase);
+        return buf;
+    }
+
+    // how long a joint move from -> to takes at JOINT_REF_SPEED, set by
+    // its largest step [s]
+    static double moveTime(const Vector &from, const Vector &to)
+    {
+        double travel=0.0;
+        for (size_t j=0; j<from.size() && j<to.size(); j++)
+            travel=std::max(travel,fabs(to[j]-from[j]));
+        return travel/JOINT_REF_SPEED;
+    }
+
+    // wait until the joint move commanded on pos is done, polling every
+    // motion_poll seconds; returns the measured completion time [s], or
+    // a negative value when it is still moving motion_timeout after the
+    // duration [s] it should take. A handoff > 0 [s] returns then, still
+    // moving, for the next target to blend in.
+    double waitMotion(IPositionControl *pos, double duration, double handoff=0.0)
+    {
+        double start=Time::now();
+        double deadline=duration+motion_timeout;
+        bool done=false;
+        while (!pos->checkMotionDone(&done) || !done)
+        {
+            if (handoff > 0.0 && Time::now()-start >= handoff)
+                break;
+            if (Time::now()-start >= deadline)
+            {
+                fprintf(stdout,"Motion not done after %g s\n",deadline);
+                return start-Time::now();
+            }
+            Time::delay(motion_poll);
+        }
+        return Time::now()-start;
+    }
+
+    // same for the Cartesian controller, which takes traj_time, through
+    // the "motion-done" event when enabled (arm() it before sending the
+    // target); its moves always run to the end
+    double waitCartesian()
+    {
+        double start=Time::now();
+        double deadline=traj_time+motion_timeout;
+        bool done=false;
+        if (motion_event)
+            done=motion_done.wait(deadline);
+        else
+            while ((!icart->checkMotionDone(&done) || !done) && Time::now()-start < deadline)
+                Time::delay(motion_poll);
+        if (!done)
+        {
+            fprintf(stdout,"Motion not done after %g s\n",deadline);
+            return start-Time::now();
+        }
+        return Time::now()-start;
     }
 
     virtual void threadRelease()
@@ -574,6 +1180,8 @@ public:
         // we require an immediate stop
         // before closing the client for safety reason
         icart->stopControl();
+        if (motion_event)
+            icart->unregisterEvent(motion_done);
 
         // it's a good rule to restore the controller
         // context as it was before opening the module
@@ -599,291 +1207,18 @@ public:
         od = home_od;
     }
 
-    void generateTarget(int i, string s)
+    // joint target of one stroke of note i, false if the table has no such note
+    bool generateTarget(int i, int phase)
     {
-        int up = -9;
-        int down = -4;
-        switch(i)
-        {
-            //DONT USE FLATS
-            case 0:
-                if(s == "up")
-                {
-                    command[0]=up;
-                    command[1]=80;
-                    command[2]=0;
-                    command[3]=67.5;
-                    command[4]=20;
-                    command[5]=0;
-                    command[6]=0;
-                }
-
-                if(s == "down")
-                {
-                    command[0]=down;
-                    command[1]=80;
-                    command[2]=0;
-                    command[3]=67.5;
-                    command[4]=20;
-                    command[5]=0;
-                    command[6]=0;
-                }
-                break;
-            case 1:
-                if(s == "up")
-                {
-                    command[0]=-62;
-                    command[1]=72;
-                    command[2]=58;
-                    command[3]=78;
-                    command[4]=22;
-                    command[5]=-2;
-                    command[6]=17;
-                }
-
-                if(s == "down")
-                {
-                    command[0]=-52;
-                    command[1]=73;
-                    command[2]=59;
-                    command[3]=78;
-                    command[4]=22;
-                    command[5]=-13;
-                    command[6]=19;
-                }
-                break;
-            case 2:
-                if(s == "up")
-                {
-                    command[0]=up;
-                    command[1]=80;
-                    command[2]=0;
-                    command[3]=63;
-                    command[4]=20;
-                    command[5]=0;
-                    command[6]=0;
-                }
-
-                if(s == "down")
-                {
-                    command[0]=down;
-                    command[1]=80;
-                    command[2]=0;
-                    command[3]=63;
-                    command[4]=20;
-                    command[5]=0;
-                    command[6]=0;
-                }
-                break;
-            case 3:
-                if(s == "up")
-                {
-                    command[0]=-67;
-                    command[1]=74;
-                    command[2]=63;
-                    command[3]=67;
-                    command[4]=19;
-                    command[5]=-6;
-                    command[6]=7;
-                }
-
-                if(s == "down")
-                {
-                    command[0]=-56;
-                    command[1]=75;
-                    command[2]=63;
-                    command[3]=68;
-                    command[4]=17;
-                    command[5]=-16;
-                    command[6]=8;   
-                }
-                break;
-            case 4:
-                if(s == "up")
-                {
-                    command[0]=up;
-                    command[1]=80;
-                    command[2]=0;
-                    command[3]=57;
-                    command[4]=20;
-                    command[5]=0;
-                    command[6]=0;
-                }
-
-                if(s == "down")
-                {
-                    command[0]=down;
-                    command[1]=80;
-                    command[2]=0;
-                    command[3]=57;
-                    command[4]=20;
-                    command[5]=0;
-                    command[6]=0;
-                }
-                break;
-            case 5:
-                if(s == "up")
-                {
-                    command[0]=up;
-                    command[1]=80;
-                    command[2]=0;
-                    command[3]=52;
-                    command[4]=20;
-                    command[5]=0;
-                    command[6]=0;
-                }
-
-                if(s == "down")
-                {
-                    command[0]=down;
-                    command[1]=80;
-                    command[2]=0;
-                    command[3]=52;
-                    command[4]=20;
-                    command[5]=0;
-                    command[6]=0;
-                }
-                break;
-            case 6:
-                if(s == "up")
-                {
-                    command[0]=-75;
-                    command[1]=71;
-                    command[2]=64;
-                    command[3]=44;
-                    command[4]=21;
-                    command[5]=-7;
-                    command[6]=-13;
-                }
-
-                if(s == "down")
-                {
-                    command[0]=-63;
-                    command[1]=71;
-                    command[2]=63;
-                    command[3]=45;
-                    command[4]=15;
-                    command[5]=-17;
-                    command[6]=-12;
-                }
-                break;
-            case 7:
-                if(s == "up")
-                {
-                    command[0]=up;
-                    command[1]=80;
-                    command[2]=0;
-                    command[3]=47;
-                    command[4]=20;
-                    command[5]=0;
-                    command[6]=0;
-                }
-
-                if(s == "down")
-                {
-                    command[0]=down;
-                    command[1]=80;
-                    command[2]=0;
-                    command[3]=47;
-                    command[4]=20;
-                    command[5]=0;
-                    command[6]=0;
-                }
-                break;
-            case 8:
-                if(s == "up")
-                {
-                    command[0]=-84;
-                    command[1]=65;
-                    command[2]=65;
-                    command[3]=26;
-                    command[4]=27;
-                    command[5]=-10;
-                    command[6]=-20;
-                }
-
-                if(s == "down")
-                {
-                    command[0]=-73;
-                    command[1]=66;
-                    command[2]=68;
-                    command[3]=26;
-                    command[4]=18;
-                    command[5]=-18;
-                    command[6]=-20;
-                }
-                break;
-            case 9:
-                if(s == "up")
-                {
-                    command[0]=up;
-                    command[1]=80;
-                    command[2]=0;
-                    command[3]=75;
-                    command[4]=20;
-                    command[5]=0;
-                    command[6]=0;
-                }
-
-                if(s == "down")
-                {
-                    command[0]=down;
-                    command[1]=80;
-                    command[2]=0;
-                    command[3]=75;
-                    command[4]=20;
-                    command[5]=0;
-                    command[6]=0;
-                }
-                break;
-            case 10:
-                if(s == "up")
-                {
-                    command[0]=-87;
-                    command[1]=59;
-                    command[2]=60;
-                    command[3]=16;
-                    command[4]=39;
-                    command[5]=-16;
-                    command[6]=-12;
-                }
-
-                if(s == "down")
-                {
-                    command[0]=-77;
-                    command[1]=59;
-                    command[2]=57;
-                    command[3]=16;
-                    command[4]=36;
-                    command[5]=-19;
-                    command[6]=-12;
-                }
-                break;
-            case 11:
-                if(s == "up")
-                {
-                    command[0]=up;
-                    command[1]=80;
-                    command[2]=0;
-                    command[3]=71.5;
-                    command[4]=20;
-                    command[5]=0;
-                    command[6]=0;
-                }
+        std::lock_guard<std::mutex> lock(keys_mutex);
+        if (!keys || i < 0 || i >= keys->notes)
+            return false;
 
-                if(s == "down")
-                {
-                    command[0]=down;
-                    command[1]=80;
-                    command[2]=0;
-                    command[3]=71.5;
-                    command[4]=20;
-                    command[5]=0;
-                    command[6]=0;
-                }
-                break;
-        }
-}
+        const double *q=keys->at(i,phase);
+        for (int j=0; j<keys->joints; j++)
+            command[j]=q[j];
+        return true;
+    }
 
     void goHome()
     {
@@ -931,24 +1266,83 @@ class CtrlModule: public RFModule
 {
 protected:
     CtrlThread *thr;
+    // operator commands while playing, e.g. "yarp rpc /piano/rpc":
+    //   pause | resume | step [n] | mode interactive|auto|step |
+    //   tempo <frames/min> | reload | status | quit
+    RpcServer rpcPort;
 
 public:
     virtual bool configure(ResourceFinder &rf)
     {
         Time::turboBoost();
 
-        thr=new CtrlThread(CTRL_THREAD_PER);
+        thr=new CtrlThread(CTRL_THREAD_PER,rf);
         if (!thr->start())
         {
             delete thr;
             return false;
         }
 
+        rpcPort.open(rf.check("rpc",Value("/piano/rpc")).asString());
+        attach(rpcPort);
+        return true;
+    }
+
+    virtual bool respond(const Bottle &command, Bottle &reply)
+    {
+        std::string cmd=command.get(0).asString();
+        if (cmd=="pause")
+            thr->setPaused(true);
+        else if (cmd=="resume")
+            thr->setPaused(false);
+        else if (cmd=="step")
+            thr->addSteps(command.size()>1 ? command.get(1).asInt() : 1);
+        else if (cmd=="mode" && command.size()>1)
+        {
+            std::string mode=command.get(1).asString();
+            if (mode=="interactive")
+                thr->setPlayback(PLAYBACK_INTERACTIVE);
+            else if (mode=="auto")
+                thr->setPlayback(PLAYBACK_AUTO);
+            else if (mode=="step")
+                thr->setPlayback(PLAYBACK_STEP);
+            else
+            {
+                reply.addString("unknown mode "+mode);
+                return true;
+            }
+        }
+        else if (cmd=="tempo" && command.size()>1 && command.get(1).asDouble()>0.0)
+            thr->setTempo(command.get(1).asDouble());
+        else if (cmd=="reload")
+        {
+            // the keystroke table, e.g. after retuning a key
+            try
+            {
+                thr->loadKeystrokes();
+            }
+            catch (const std::exception &e)
+            {
+                reply.addString(e.what());
+                return true;
+            }
+        }
+        else if (cmd!="status")
+            return RFModule::respond(command,reply);
+
+        reply.addString(thr->status());
+        return true;
+    }
+
+    virtual bool interruptModule()
+    {
+        rpcPort.interrupt();
         return true;
     }
 
     virtual bool close()
     {
+        rpcPort.close();
         thr->stop();
         delete thr;
 
@@ -959,47 +1353,164 @@ public:
     virtual bool   updateModule() { return true; }
 };
 
-std::string exec(const char* cmd) {
-    char buffer[128];
-    std::string result = "";
+// run cmd and decode the binary note stream it writes to stdout,
+// chunk by chunk as it arrives on the pipe, flags gets the stream flags
+std::vector<NoteRecord> exec(const char* cmd, uint16_t *flags = NULL) {
+    char buffer[4096];
+    NoteStreamReader reader;
     FILE* pipe = popen(cmd, "r");
     if (!pipe) throw std::runtime_error("popen() failed!");
     try {
-        while (!feof(pipe)) {
-            if (fgets(buffer, 128, pipe) != NULL)
-                result += buffer;
-        }
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), pipe)) > 0)
+            reader.feed(buffer, n);
     } catch (...) {
         pclose(pipe);
         throw;
     }
 
     pclose(pipe);
-    return result;
+    if (!reader.complete())
+        throw std::runtime_error("truncated note stream");
+    if (flags)
+        *flags = reader.flags;
+    return reader.records;
+}
+
+// one stroke per note event
+void setNotes(const std::vector<NoteEvent> &events)
+{
+    next_note.resize(events.size());
+    note_confidence.resize(events.size());
+    note_onset.resize(events.size());
+    for (size_t j = 0; j < events.size(); j++)
+    {
+        next_note[j] = events[j].note;
+        note_confidence[j] = events[j].confidence;
+        note_onset[j] = events[j].onset;
+    }
+}
+
+// transcribe the song with the native LSTM engine, smoothing the notes
+// with the Viterbi decoder
+void predictNative(const std::string &song, const std::string &param, double switch_penalty)
+{
+    RNN model;
+    model.load_param(param);
+
+    std::vector<float> X, Y;
+    int T = get_data(song, X, Y);
+    Prediction p = model.predict_with_confidence(X, T);
+    std::vector<NoteEvent> events = decode_notes(p.probabilities.data(), T, model.output_dim,
+                                                 switch_penalty);
+    fprintf(stdout,"%d frames decoded into %d notes\n",T,(int)events.size());
+    setNotes(events);
+}
+
+// ask the persistent rnn_server, which already holds the model
+void predictServer(const std::string &socket_path, const std::string &song, double timeout,
+                   double switch_penalty)
+{
+    // the server runs the Viterbi decoder, confidence and onsets come back
+    std::vector<NoteRecord> notes = rnn_server_decode_file(socket_path, song, switch_penalty,
+                                                           timeout);
+    std::vector<NoteEvent> events(notes.size());
+    for (size_t e = 0; e < notes.size(); e++)
+    {
+        events[e].note = notes[e].note;
+        events[e].confidence = notes[e].confidence;
+        events[e].onset = (int)notes[e].onset;
+        events[e].duration = (int)notes[e].duration;
+    }
+    setNotes(events);
+}
+
+// classify one frame and hand the note to the control thread
+void streamFrame(RNNStream &stream, const float *x)
+{
+    int note = stream.push(x);
+    double confidence = stream.probabilities()[note];
+
+    // a held note is one stroke, not one per frame
+    std::lock_guard<std::mutex> lock(note_mutex);
+    if (next_note.size() > 0 && next_note[next_note.size() - 1] == note)
+        return;
+    next_note.push_back(note);
+    note_confidence.push_back(confidence);
+    note_onset.push_back(stream.frames() - 1);
 }
 
-int main()
+// transcribe the song frame by frame, handing every note to the
+// control thread as soon as it is classified; a .wav song is turned
+// into spectra on the fly, so playing starts after the first window
+void predictStreaming(const RNN *model, const std::string &song)
 {
-    std::string res = exec("./call_python");
-    std::cout << res << std::endl;
-    next_note.resize(res.length()/2);
-    int i = 0;
-    int j = 0;
-    int num = 0;
-    for(i = 0; i < res.length(); i++)
+    try
     {
-        if(isdigit(res[i]))
+        RNNStream stream(*model);
+        if (song.size() > 4 && song.compare(song.size() - 4, 4, ".wav") == 0)
         {
-            num *= 10;
-            num += res[i] - '0';
+            SpectrumStream spectrum(song);
+            if (spectrum.bins() != model->input_dim)
+                throw std::runtime_error("spectrum does not match the model input size");
+
+            std::vector<double> bins(spectrum.bins());
+            std::vector<float> frame(spectrum.bins());
+            while (spectrum.next(&bins[0]))
+            {
+                for (size_t k = 0; k < bins.size(); k++)
+                    frame[k] = (float)bins[k];
+                streamFrame(stream, &frame[0]);
+            }
         }
         else
         {
-            next_note[j] = num;
-            j++;
-            num = 0;
+            std::vector<float> X, Y;
+            int T = get_data(song, X, Y);
+            model->check_input(X, T);
+            for (int t = 0; t < T; t++)
+                streamFrame(stream, &X[(size_t)t * model->input_dim]);
         }
     }
+    catch (const std::exception &e)
+    {
+        fprintf(stdout,"Error: %s\n",e.what());
+    }
+
+    std::lock_guard<std::mutex> lock(note_mutex);
+    song_done = true;
+}
+
+// transcribe the song through the embedded python interpreter
+void predictPython()
+{
+    uint16_t flags = 0;
+    std::vector<NoteRecord> notes = exec("./call_python", &flags);
+    bool has_confidence = flags & NOTE_STREAM_CONFIDENCE;
+
+    // only the winning probability comes back, merge repeats and average it
+    std::vector<int> path(notes.size());
+    for (size_t j = 0; j < notes.size(); j++)
+        path[j] = notes[j].note;
+    std::vector<NoteEvent> events = note_events(path, NULL, 0);
+    for (size_t e = 0; e < events.size() && has_confidence; e++)
+    {
+        double sum = 0.0;
+        for (int t = events[e].onset; t < events[e].onset + events[e].duration; t++)
+            sum += notes[t].confidence;
+        events[e].confidence = (float)(sum / events[e].duration);
+    }
+    setNotes(events);
+    fprintf(stdout,"next_note = %s\n",next_note.toString().c_str());
+}
+
+int main(int argc, char *argv[])
+{
+    ResourceFinder rf;
+    rf.configure(argc, argv);
+
+    // before any backend starts: the stream backend's producer thread
+    // must not be left running on an early return
     Network yarp;
     if (!yarp.checkNetwork())
     {
@@ -1007,8 +1518,80 @@ int main()
         return 1;
     }
 
+    // --backend native|stream|server|python selects how the song is transcribed
+    std::string backend = rf.check("backend", Value("native")).asString();
+    std::string song = rf.check("song", Value(RNN_DEFAULT_SONG)).asString();
+    std::string param = rf.check("param", Value(RNN_PARAM_FILE)).asString();
+    // nats a note change costs in the Viterbi decoder, higher = fewer strokes
+    double switch_penalty = rf.check("switch_penalty", Value(DECODER_SWITCH_PENALTY)).asDouble();
+
+    RNN model;
+    std::thread producer;
+    if (backend == "server")
+    {
+        std::string socket_path = rf.check("socket", Value(RNN_SERVER_SOCKET)).asString();
+        double timeout = rf.check("timeout", Value(5.0)).asDouble();
+        try
+        {
+            predictServer(socket_path, song, timeout, switch_penalty);
+        }
+        catch (const std::exception &e)
+        {
+            // no server running: transcribe in process instead
+            fprintf(stdout,"%s, falling back to the native backend\n",e.what());
+            backend = "native";
+        }
+    }
+
+    if (backend == "server")
+        fprintf(stdout,"next_note = %s\n",next_note.toString().c_str());
+    else if (backend == "python")
+    {
+        try
+        {
+            predictPython();
+        }
+        catch (const std::exception &e)
+        {
+            fprintf(stdout,"Error: %s\n",e.what());
+            return 1;
+        }
+    }
+    else if (backend == "stream")
+    {
+        try
+        {
+            model.load_param(param);
+        }
+        catch (const std::exception &e)
+        {
+            fprintf(stdout,"Error: %s\n",e.what());
+            return 1;
+        }
+        next_note.clear();
+        note_confidence.clear();
+        note_onset.clear();
+        song_done = false;
+        producer = std::thread(predictStreaming, &model, song);
+    }
+    else
+    {
+        try
+        {
+            predictNative(song, param, switch_penalty);
+        }
+        catch (const std::exception &e)
+        {
+            fprintf(stdout,"Error: %s\n",e.what());
+            return 1;
+        }
+        fprintf(stdout,"next_note = %s\n",next_note.toString().c_str());
+    }
+
     CtrlModule mod;
 
-    ResourceFinder rf;
-    return mod.runModule(rf);
+    int ret = mod.runModule(rf);
+    if (producer.joinable())
+        producer.join();
+    return ret;
 }
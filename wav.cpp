@@ -0,0 +1,165 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// RIFF/WAVE reader, see wav.h.
+
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+
+#include <sys/stat.h>
+
+#include "wav.h"
+
+using namespace std;
+
+#define WAV_FORMAT_PCM          0x0001
+#define WAV_FORMAT_FLOAT        0x0003
+#define WAV_FORMAT_EXTENSIBLE   0xfffe
+
+#define WAV_BLOCK_FRAMES        4096
+
+static unsigned int le16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static unsigned int le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+WavReader::WavReader(const string &filename) :
+    f(NULL), rate(0), nchannels(0), bits(0), is_float(false), total(0), position(0)
+{
+    f = fopen(filename.c_str(), "rb");
+    if (!f)
+        throw runtime_error("wav: cannot open " + filename);
+
+    try
+    {
+        unsigned char riff[12];
+        if (fread(riff, 1, 12, f) != 12 || memcmp(riff, "RIFF", 4) != 0 ||
+            memcmp(riff + 8, "WAVE", 4) != 0)
+            throw runtime_error("wav: " + filename + " is not a RIFF/WAVE file");
+
+        bool have_fmt = false;
+        while (true)
+        {
+            unsigned char chunk[8];
+            if (fread(chunk, 1, 8, f) != 8)
+                throw runtime_error("wav: " + filename + " has no data chunk");
+            unsigned long size = le32(chunk + 4);
+
+            if (memcmp(chunk, "fmt ", 4) == 0)
+            {
+                if (size < 16 || size > 64)
+                    throw runtime_error("wav: bad fmt chunk in " + filename);
+                unsigned char fmt[64];
+                if (fread(fmt, 1, size, f) != size)
+                    throw runtime_error("wav: truncated fmt chunk in " + filename);
+                unsigned int tag = le16(fmt);
+                nchannels = le16(fmt + 2);
+                rate = le32(fmt + 4);
+                bits = le16(fmt + 14);
+                if (tag == WAV_FORMAT_EXTENSIBLE && size >= 26)
+                    tag = le16(fmt + 24);
+
+                is_float = (tag == WAV_FORMAT_FLOAT);
+                bool ok = (tag == WAV_FORMAT_PCM && (bits == 8 || bits == 16 || bits == 24 || bits == 32)) ||
+                          (is_float && (bits == 32 || bits == 64));
+                if (!ok || nchannels < 1 || rate < 1)
+                    throw runtime_error("wav: unsupported sample format in " + filename);
+                have_fmt = true;
+            }
+            else if (memcmp(chunk, "data", 4) == 0)
+            {
+                if (!have_fmt)
+                    throw runtime_error("wav: data before fmt chunk in " + filename);
+
+                // recorders that never patched the header leave the size
+                // at 0 or 0xffffffff, trust the file length then
+                struct stat st;
+                long here = ftell(f);
+                if (fstat(fileno(f), &st) == 0 && here >= 0)
+                {
+                    unsigned long avail = (unsigned long)st.st_size - (unsigned long)here;
+                    if (size == 0 || size > avail)
+                        size = avail;
+                }
+                total = size / ((size_t)nchannels * (bits / 8));
+                break;
+            }
+            else if (fseek(f, (long)(size + (size & 1)), SEEK_CUR) != 0)
+                throw runtime_error("wav: truncated chunk in " + filename);
+        }
+    }
+    catch (...)
+    {
+        fclose(f);
+        throw;
+    }
+}
+
+WavReader::~WavReader()
+{
+    fclose(f);
+}
+
+size_t WavReader::read(double *out, size_t n)
+{
+    size_t bytes = bits / 8;
+    size_t frame = bytes * nchannels;
+    size_t done = 0;
+
+    while (done < n && position < total)
+    {
+        size_t want = n - done;
+        if (want > WAV_BLOCK_FRAMES)
+            want = WAV_BLOCK_FRAMES;
+        if (want > total - position)
+            want = total - position;
+
+        raw.resize(want * frame);
+        size_t got = fread(&raw[0], frame, want, f);
+        if (got == 0)
+        {
+            total = position;
+            break;
+        }
+
+        for (size_t i = 0; i < got; i++)
+        {
+            double sum = 0.0;
+            for (int ch = 0; ch < nchannels; ch++)
+            {
+                const unsigned char *p = &raw[i * frame + ch * bytes];
+                double v;
+                if (is_float && bits == 32)
+                {
+                    float x;
+                    memcpy(&x, p, 4);
+                    v = x * 32768.0;
+                }
+                else if (is_float)
+                {
+                    double x;
+                    memcpy(&x, p, 8);
+                    v = x * 32768.0;
+                }
+                else if (bits == 8)
+                    v = ((int)p[0] - 128) * 256.0;
+                else if (bits == 16)
+                    v = (int16_t)le16(p);
+                else if (bits == 24)
+                    v = (int32_t)((p[0] << 8) | (p[1] << 16) | ((unsigned int)p[2] << 24)) / 65536.0;
+                else
+                    v = (int32_t)le32(p) / 65536.0;
+                sum += v;
+            }
+            out[done + i] = sum / nchannels;
+        }
+        done += got;
+        position += got;
+    }
+    return done;
+}
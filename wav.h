@@ -0,0 +1,47 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Streaming reader for RIFF/WAVE files: 8/16/24/32 bit integer PCM and
+// 32/64 bit float, plain or WAVE_FORMAT_EXTENSIBLE. Samples come out as
+// mono doubles on the 16 bit scale (full scale = 32768) whatever the
+// file stores, which is the scale the bundled spectra were computed on.
+
+#ifndef WAV_H
+#define WAV_H
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class WavReader
+{
+public:
+    explicit WavReader(const std::string &filename);
+    ~WavReader();
+
+    int sample_rate() const { return rate; }
+    int channels() const { return nchannels; }
+
+    // sample frames (one sample per channel) in the file
+    size_t frames() const { return total; }
+
+    // read up to n frames with the channels averaged, returns how many
+    // were read; 0 at the end of the data chunk
+    size_t read(double *out, size_t n);
+
+protected:
+    FILE *f;
+    int rate;
+    int nchannels;
+    int bits;
+    bool is_float;
+    size_t total;
+    size_t position;
+    std::vector<unsigned char> raw;
+
+private:
+    WavReader(const WavReader &);
+    WavReader &operator=(const WavReader &);
+};
+
+#endif
@@ -0,0 +1,71 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Converts a WAV recording into an npz with the same "data" array the
+// dirty_example_*.npz files carry, so new songs can be transcribed by
+// every backend (and by rnn_LSTM_CPU.py).
+//
+// usage: wav_spectrum [--window s] [--hop s] [--hann] [--bins n] song.wav out.npz
+//
+// Frames are written to the archive as they are computed.
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "npz.h"
+#include "spectrum.h"
+
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+    SpectrumConfig config;
+    vector<string> files;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--window" && i + 1 < argc)
+            config.window = atof(argv[++i]);
+        else if (arg == "--hop" && i + 1 < argc)
+            config.hop = atof(argv[++i]);
+        else if (arg == "--hann")
+            config.shape = WINDOW_HANN;
+        else if (arg == "--bins" && i + 1 < argc)
+            config.bins = atoi(argv[++i]);
+        else
+            files.push_back(arg);
+    }
+    if (files.size() != 2)
+    {
+        fprintf(stderr, "usage: wav_spectrum [--window s] [--hop s] [--hann] [--bins n] song.wav out.npz\n");
+        return 1;
+    }
+
+    try
+    {
+        SpectrumStream stream(files[0], config);
+        vector<size_t> shape;
+        shape.push_back(stream.frames());
+        shape.push_back(stream.bins());
+
+        NpzWriter out(files[1]);
+        out.begin("data", 'f', sizeof(double), shape);
+        vector<double> frame(stream.bins());
+        while (stream.next(&frame[0]))
+            out.write(&frame[0], frame.size() * sizeof(double));
+        out.end();
+        out.close();
+
+        fprintf(stdout, "%s: %d frames of %d bins at %d Hz\n", files[1].c_str(),
+                stream.frames(), stream.bins(), stream.sample_rate());
+    }
+    catch (const exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
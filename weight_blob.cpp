@@ -0,0 +1,256 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Weight blob writer and mmap loader, see weight_blob.h.
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rnn_LSTM_CPU.h"
+#include "weight_blob.h"
+
+using namespace std;
+
+static_assert(sizeof(WeightBlobHeader) == 64, "blob header must stay 64 bytes");
+static_assert(sizeof(WeightBlobSection) == 32, "blob section entry must stay 32 bytes");
+
+static size_t align_up(size_t n)
+{
+    return (n + LSTM_ALIGN - 1) / LSTM_ALIGN * LSTM_ALIGN;
+}
+
+// unmaps the blob once the last SharedWeights pointing into it is gone
+struct BlobMapping
+{
+    BlobMapping(void *addr, size_t length) : addr(addr), length(length) { }
+    ~BlobMapping() { munmap(addr, length); }
+
+    void *addr;
+    size_t length;
+};
+
+bool weight_blob_check(const string &filename)
+{
+    char magic[8];
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f)
+        return false;
+    bool blob = fread(magic, 1, 8, f) == 8 && memcmp(magic, WEIGHT_BLOB_MAGIC, 8) == 0;
+    fclose(f);
+    return blob;
+}
+
+void weight_blob_write(const RNN &model, const string &filename, bool int8)
+{
+    if (model.A.empty() || model.packed.w.empty())
+        throw runtime_error("weight blob: the model has no float weights to write");
+
+    LSTMInt8 q;
+    if (int8)
+        lstm_quantize_rows(model.A.data(), model.hidden_dim, model.input_dim, q);
+
+    struct Payload
+    {
+        WeightBlobId id;
+        size_t word_size;
+        const void *data;
+        size_t count;
+    };
+    vector<Payload> payloads;
+    if (!int8)
+        payloads.push_back({BLOB_A, 4, model.A.data(), model.A.size()});
+    payloads.push_back({BLOB_U, 4, model.U.data(), model.U.size()});
+    payloads.push_back({BLOB_W, 4, model.W.data(), model.W.size()});
+    payloads.push_back({BLOB_B, 4, model.b.data(), model.b.size()});
+    payloads.push_back({BLOB_V, 4, model.V.data(), model.V.size()});
+    payloads.push_back({BLOB_C_O, 4, model.c_o.data(), model.c_o.size()});
+    payloads.push_back({BLOB_PACKED_W, 4, model.packed.w.data(), model.packed.w.size()});
+    payloads.push_back({BLOB_PACKED_BIAS, 4, model.packed.bias.data(), model.packed.bias.size()});
+    if (int8)
+    {
+        payloads.push_back({BLOB_INT8_W, 1, q.w.data(), q.w.size()});
+        payloads.push_back({BLOB_INT8_SCALE, 4, q.scale.data(), q.scale.size()});
+    }
+
+    WeightBlobHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, WEIGHT_BLOB_MAGIC, 8);
+    h.version = WEIGHT_BLOB_VERSION;
+    h.byte_order = WEIGHT_BLOB_BYTE_ORDER;
+    h.flags = int8 ? WEIGHT_BLOB_INT8 : 0;
+    h.input_dim = model.input_dim;
+    h.hidden_dim = model.hidden_dim;
+    h.output_dim = model.output_dim;
+    h.padded = model.packed.padded;
+    h.block = LSTM_BLOCK;
+    h.int8_ld = int8 ? q.ld : 0;
+    h.sections = (uint32_t)payloads.size();
+
+    vector<WeightBlobSection> table(payloads.size());
+    size_t offset = align_up(sizeof(h) + table.size() * sizeof(WeightBlobSection));
+    for (size_t i = 0; i < payloads.size(); i++)
+    {
+        memset(&table[i], 0, sizeof(table[i]));
+        table[i].id = payloads[i].id;
+        table[i].word_size = (uint32_t)payloads[i].word_size;
+        table[i].offset = offset;
+        table[i].count = payloads[i].count;
+        offset = align_up(offset + payloads[i].count * payloads[i].word_size);
+    }
+    h.file_size = offset;
+
+    FILE *f = fopen(filename.c_str(), "wb");
+    if (!f)
+        throw runtime_error("weight blob: cannot create " + filename);
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+              fwrite(&table[0], sizeof(WeightBlobSection), table.size(), f) == table.size();
+    static const char zeros[LSTM_ALIGN] = { 0 };
+    size_t at = sizeof(h) + table.size() * sizeof(WeightBlobSection);
+    for (size_t i = 0; ok && i < payloads.size(); i++)
+    {
+        ok = fwrite(zeros, 1, table[i].offset - at, f) == table[i].offset - at;
+        size_t bytes = payloads[i].count * payloads[i].word_size;
+        ok = ok && fwrite(payloads[i].data, 1, bytes, f) == bytes;
+        at = table[i].offset + bytes;
+    }
+    ok = ok && fwrite(zeros, 1, h.file_size - at, f) == h.file_size - at;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok)
+        throw runtime_error("weight blob: cannot write " + filename);
+}
+
+template <typename T>
+static SharedWeights<T> section_view(const char *base, const WeightBlobSection &s,
+                                     const shared_ptr<const void> &owner)
+{
+    return SharedWeights<T>((const T *)(base + s.offset), (size_t)s.count, owner);
+}
+
+template <typename T>
+static vector<T> section_copy(const char *base, const WeightBlobSection &s)
+{
+    const T *p = (const T *)(base + s.offset);
+    return vector<T>(p, p + s.count);
+}
+
+void weight_blob_load(const string &filename, RNN &model)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw runtime_error("weight blob: cannot open " + filename);
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(WeightBlobHeader))
+    {
+        close(fd);
+        throw runtime_error("weight blob: " + filename + " is truncated");
+    }
+    size_t length = (size_t)st.st_size;
+    void *addr = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        throw runtime_error("weight blob: cannot map " + filename);
+    shared_ptr<const void> owner = make_shared<BlobMapping>(addr, length);
+    const char *base = (const char *)addr;
+
+    const WeightBlobHeader &h = *(const WeightBlobHeader *)base;
+    if (memcmp(h.magic, WEIGHT_BLOB_MAGIC, 8) != 0)
+        throw runtime_error("weight blob: " + filename + " has a bad magic");
+    if (h.byte_order != WEIGHT_BLOB_BYTE_ORDER)
+        throw runtime_error("weight blob: " + filename + " was written with another byte order");
+    if (h.version != WEIGHT_BLOB_VERSION)
+        throw runtime_error("weight blob: " + filename + " has an unsupported version, reconvert it");
+    if (h.block != LSTM_BLOCK)
+        throw runtime_error("weight blob: " + filename + " was packed for another LSTM_BLOCK, reconvert it");
+    if (h.file_size != length ||
+        sizeof(h) + (size_t)h.sections * sizeof(WeightBlobSection) > length)
+        throw runtime_error("weight blob: " + filename + " is truncated");
+
+    size_t I = h.input_dim, H = h.hidden_dim, O = h.output_dim;
+    size_t nb = (H + LSTM_BLOCK - 1) / LSTM_BLOCK;
+    bool int8 = (h.flags & WEIGHT_BLOB_INT8) != 0;
+    // the int8 kernels load rows of int8_ld bytes with aligned loads
+    if (h.padded != nb * LSTM_BLOCK ||
+        (int8 && (h.int8_ld < I || h.int8_ld % LSTM_ALIGN != 0)))
+        throw runtime_error("weight blob: " + filename + " has inconsistent dimensions");
+
+    // expected element count and size of every section this blob must have
+    struct Expect { WeightBlobId id; size_t word_size; size_t count; };
+    vector<Expect> expect;
+    if (!int8)
+        expect.push_back({BLOB_A, 4, H * I});
+    expect.push_back({BLOB_U, 4, 4 * H * H});
+    expect.push_back({BLOB_W, 4, 4 * H * H});
+    expect.push_back({BLOB_B, 4, 4 * H});
+    expect.push_back({BLOB_V, 4, O * H});
+    expect.push_back({BLOB_C_O, 4, O});
+    expect.push_back({BLOB_PACKED_W, 4, nb * 2 * H * 4 * LSTM_BLOCK});
+    expect.push_back({BLOB_PACKED_BIAS, 4, nb * 4 * LSTM_BLOCK});
+    if (int8)
+    {
+        expect.push_back({BLOB_INT8_W, 1, H * h.int8_ld});
+        expect.push_back({BLOB_INT8_SCALE, 4, H});
+    }
+
+    const WeightBlobSection *table = (const WeightBlobSection *)(base + sizeof(h));
+    vector<const WeightBlobSection *> found(BLOB_INT8_SCALE + 1, (const WeightBlobSection *)NULL);
+    for (uint32_t i = 0; i < h.sections; i++)
+    {
+        const WeightBlobSection &s = table[i];
+        if (s.id < BLOB_A || s.id > BLOB_INT8_SCALE || s.offset % LSTM_ALIGN != 0 ||
+            s.offset > length || s.word_size == 0 ||
+            s.count > (length - s.offset) / s.word_size)
+            throw runtime_error("weight blob: " + filename + " has a corrupt section table");
+        found[s.id] = &s;
+    }
+    for (size_t i = 0; i < expect.size(); i++)
+    {
+        const WeightBlobSection *s = found[expect[i].id];
+        if (!s || s->word_size != expect[i].word_size || s->count != expect[i].count)
+            throw runtime_error("weight blob: " + filename + " does not match its header");
+    }
+
+    model.input_dim = (int)I;
+    model.hidden_dim = (int)H;
+    model.output_dim = (int)O;
+    model.A = int8 ? SharedWeights<float>() : section_view<float>(base, *found[BLOB_A], owner);
+
+    // the small raw tensors are only read by the reference path and the
+    // output layer, they are copied out
+    model.U = section_copy<float>(base, *found[BLOB_U]);
+    model.W = section_copy<float>(base, *found[BLOB_W]);
+    model.b = section_copy<float>(base, *found[BLOB_B]);
+    model.V = section_copy<float>(base, *found[BLOB_V]);
+    model.c_o = section_copy<float>(base, *found[BLOB_C_O]);
+
+    model.packed.hidden = (int)H;
+    model.packed.padded = (int)h.padded;
+    model.packed.w = section_view<float>(base, *found[BLOB_PACKED_W], owner);
+    model.packed.bias = section_view<float>(base, *found[BLOB_PACKED_BIAS], owner);
+
+    if (int8)
+    {
+        model.quantized.rows = (int)H;
+        model.quantized.cols = (int)I;
+        model.quantized.ld = (int)h.int8_ld;
+        model.quantized.w = section_view<signed char>(base, *found[BLOB_INT8_W], owner);
+        model.quantized.scale = section_view<float>(base, *found[BLOB_INT8_SCALE], owner);
+        model.projection = PROJECT_INT8;
+        model.columns.w = SharedWeights<float>();
+    }
+    else
+    {
+        model.quantized.w = SharedWeights<signed char>();
+        model.quantized.scale = SharedWeights<float>();
+        model.set_projection(model.projection);
+    }
+
+    // pull the pages in now rather than on the first song
+    madvise(addr, length, MADV_WILLNEED);
+}
@@ -0,0 +1,86 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+//
+// Weight blob: the LSTM parameters as float32 in exactly the layout the
+// kernels read, so loading a model is one mmap instead of decoding the
+// float64 npz and repacking it. The file is mapped shared and read-only,
+// so every controller, server and batch process on a host uses the same
+// page cache copy of A and of the packed recurrent weights.
+//
+// Layout, native (little endian) byte order, every section 64 byte
+// aligned:
+//
+//   WeightBlobHeader                       64 bytes
+//   WeightBlobSection[sections]            32 bytes each
+//   section payloads
+//
+// A float blob carries A, U, W, b, V, c_o and the packed U/W/b. An int8
+// blob (WEIGHT_BLOB_INT8) replaces A by its per-row quantized copy, a
+// quarter of the size, and then only supports PROJECT_INT8.
+//
+// Blobs are tied to the LSTM_BLOCK they were packed for; bump
+// WEIGHT_BLOB_VERSION whenever the packed layout changes.
+
+#ifndef WEIGHT_BLOB_H
+#define WEIGHT_BLOB_H
+
+#include <stdint.h>
+#include <string>
+
+#define WEIGHT_BLOB_MAGIC       "LSTMBLOB"
+#define WEIGHT_BLOB_VERSION     1
+#define WEIGHT_BLOB_BYTE_ORDER  0x01020304u
+#define WEIGHT_BLOB_INT8        0x0001
+
+enum WeightBlobId
+{
+    BLOB_A = 1,         // float (hidden, input)
+    BLOB_U,             // float (4, hidden, hidden)
+    BLOB_W,             // float (4, hidden, hidden)
+    BLOB_B,             // float (4, hidden)
+    BLOB_V,             // float (output, hidden)
+    BLOB_C_O,           // float (output)
+    BLOB_PACKED_W,      // float LSTMPacked::w
+    BLOB_PACKED_BIAS,   // float LSTMPacked::bias
+    BLOB_INT8_W,        // int8 LSTMInt8::w (hidden, int8_ld)
+    BLOB_INT8_SCALE     // float LSTMInt8::scale (hidden)
+};
+
+struct WeightBlobHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t flags;
+    uint32_t input_dim;
+    uint32_t hidden_dim;
+    uint32_t output_dim;
+    uint32_t padded;        // LSTMPacked::padded
+    uint32_t block;         // LSTM_BLOCK the weights were packed for
+    uint32_t int8_ld;       // LSTMInt8::ld, 0 without WEIGHT_BLOB_INT8
+    uint32_t sections;
+    uint64_t file_size;
+    uint64_t reserved;
+};
+
+struct WeightBlobSection
+{
+    uint32_t id;            // WeightBlobId
+    uint32_t word_size;     // bytes per element
+    uint64_t offset;        // from the start of the file
+    uint64_t count;         // elements
+    uint64_t reserved;
+};
+
+class RNN;
+
+// true when filename starts with the blob magic
+bool weight_blob_check(const std::string &filename);
+
+// write the loaded model, quantizing A when int8 is set
+void weight_blob_write(const RNN &model, const std::string &filename, bool int8);
+
+// map a blob and point the model at it; the mapping lives as long as
+// the model (or any copy of it) does
+void weight_blob_load(const std::string &filename, RNN &model);
+
+#endif